@@ -0,0 +1,187 @@
+#ifndef CCKIT_ADDRESSABLE_PRIORITY_QUEUE_H
+#define CCKIT_ADDRESSABLE_PRIORITY_QUEUE_H
+
+#include "internal/config.h"
+#include "vector.h"
+#include "heap.h"
+
+namespace cckit
+{
+	/*
+	An addressable priority queue hands out a handle for every pushed element. The handle stays valid while the element is
+	in the queue, however often sifts move it around, so that its key can be changed or the element removed in logarithmic
+	time without searching for it first. This is the decrease-key operation Dijkstra and A* need to avoid lazy duplicate
+	insertion.
+
+	The heap itself only stores handles; a position map from handle to heap index is kept up to date by every sift. Handles
+	of popped or erased elements are recycled by later pushes, so contains() only answers for handles the caller still owns.
+
+	"T"
+	The type of the stored elements.
+
+	"Compare"
+	A Compare type providing a strict weak ordering. As with priority_queue, the largest element appears as top() by default.
+
+	"Arity"
+	The number of children per heap node, see dary_heap.
+	*/
+	template<typename T, typename Compare = cckit::less<T>, size_t Arity = 2>
+	class addressable_priority_queue
+	{
+		static_assert(Arity >= 2, "a heap node needs at least two children");
+	private:
+		typedef addressable_priority_queue<T, Compare, Arity> this_type;
+	public:
+		typedef T value_type;
+		typedef Compare value_compare;
+		typedef size_t size_type;
+		typedef size_t handle_type;
+		typedef const T& const_reference;
+
+		static const handle_type NPOS = static_cast<handle_type>(-1);
+
+	public:
+		explicit addressable_priority_queue(const value_compare& _compare = value_compare())
+			: mValues(), mPositions(), mHeap(), mFreeHandles(), mCompare(_compare)
+		{}
+
+		const_reference top() const { return mValues[mHeap.front()]; }
+		handle_type top_handle() const { return mHeap.front(); }
+		bool empty() const { return mHeap.empty(); }
+		size_type size() const { return mHeap.size(); }
+
+		void reserve(size_type _cap) {
+			mValues.reserve(_cap);
+			mPositions.reserve(_cap);
+			mHeap.reserve(_cap);
+		}
+		void clear() {
+			mValues.clear();
+			mPositions.clear();
+			mHeap.clear();
+			mFreeHandles.clear();
+		}
+
+		handle_type push(const value_type& _val) { return Insert(AcquireHandle(_val)); }
+		handle_type push(value_type&& _val) { return Insert(AcquireHandle(cckit::move(_val))); }
+
+		template<typename... Args>
+		handle_type emplace(Args&&... _args) { return push(value_type(cckit::forward<Args>(_args)...)); }
+
+		void pop() { erase(mHeap.front()); }
+
+		bool contains(handle_type _handle) const {
+			return _handle < mPositions.size() && mPositions[_handle] != NPOS;
+		}
+		const_reference operator[](handle_type _handle) const {
+			assert((contains(_handle)));
+			return mValues[_handle];
+		}
+
+		void update(handle_type _handle, const value_type& _val) {
+			assert((contains(_handle)));
+			mValues[_handle] = _val;
+			Restore(mPositions[_handle]);
+		}
+		void update(handle_type _handle, value_type&& _val) {
+			assert((contains(_handle)));
+			mValues[_handle] = cckit::move(_val);
+			Restore(mPositions[_handle]);
+		}
+
+		void erase(handle_type _handle) {
+			assert((contains(_handle)));
+			size_type pos = mPositions[_handle];
+			handle_type last = mHeap.back();
+			mHeap.pop_back();
+			mPositions[_handle] = NPOS;
+			mFreeHandles.push_back(_handle);
+			if (pos < mHeap.size()) {
+				Place(last, pos);
+				Restore(pos);
+			}
+		}
+
+		bool validate() const {
+			for (size_type pos = 0; pos < mHeap.size(); ++pos) {
+				if (mPositions[mHeap[pos]] != pos)
+					return false;
+				if (pos > 0 && mCompare(mValues[mHeap[cckit::Parent<Arity>(pos)]], mValues[mHeap[pos]]))
+					return false;
+			}
+			return true;
+		}
+
+	private:
+		template<typename U>
+		handle_type AcquireHandle(U&& _val) {
+			if (mFreeHandles.empty()) {
+				mValues.push_back(cckit::forward<U>(_val));
+				mPositions.push_back(NPOS);
+				return mValues.size() - 1;
+			}
+			handle_type handle = mFreeHandles.back();
+			mFreeHandles.pop_back();
+			mValues[handle] = cckit::forward<U>(_val);
+			return handle;
+		}
+
+		handle_type Insert(handle_type _handle) {
+			mHeap.push_back(_handle);
+			SiftUp(mHeap.size() - 1);
+			return _handle;
+		}
+
+		void Place(handle_type _handle, size_type _pos) {
+			mHeap[_pos] = _handle;
+			mPositions[_handle] = _pos;
+		}
+
+		// the element at _pos may now be ordered wrongly against either its parent or its children
+		void Restore(size_type _pos) {
+			handle_type handle = mHeap[_pos];
+			SiftUp(_pos);
+			SiftDown(mPositions[handle]);
+		}
+
+		// both sifts move a hole instead of swapping, so each level costs one handle write plus its position update
+		void SiftUp(size_type _pos) {
+			handle_type handle = mHeap[_pos];
+			for (size_type parentPos = 0
+				; _pos > 0 && mCompare(mValues[mHeap[parentPos = cckit::Parent<Arity>(_pos)]], mValues[handle])
+				; _pos = parentPos)
+				Place(mHeap[parentPos], _pos);
+			Place(handle, _pos);
+		}
+
+		void SiftDown(size_type _pos) {
+			handle_type handle = mHeap[_pos];
+			size_type heapSize = mHeap.size();
+			for (size_type child = cckit::FirstChild<Arity>(_pos); child < heapSize; child = cckit::FirstChild<Arity>(_pos)) {
+				size_type largest = child, last = child + Arity;
+				if (last > heapSize)
+					last = heapSize;
+				for (++child; child < last; ++child)
+					if (mCompare(mValues[mHeap[largest]], mValues[mHeap[child]]))
+						largest = child;
+				if (!mCompare(mValues[handle], mValues[mHeap[largest]]))
+					break;
+				Place(mHeap[largest], _pos);
+				_pos = largest;
+			}
+			Place(handle, _pos);
+		}
+
+	private:
+		cckit::vector<value_type> mValues;
+		cckit::vector<size_type> mPositions;
+		cckit::vector<handle_type> mHeap;
+		cckit::vector<handle_type> mFreeHandles;
+		value_compare mCompare;
+	};
+
+	template<typename T, typename Compare, size_t Arity>
+	const typename addressable_priority_queue<T, Compare, Arity>::handle_type addressable_priority_queue<T, Compare, Arity>::NPOS;
+}
+
+#endif // !CCKIT_ADDRESSABLE_PRIORITY_QUEUE_H
\ No newline at end of file
@@ -1,89 +1,76 @@
 #ifndef CCKIT_CSV_MAP_H
 #define CCKIT_CSV_MAP_H
 
-#include <fstream>
-#include <sstream>
 #include <vector>
 #include <string>
 #include "../internal/config.h"
-#include "graph.h"
+#include "grid_graph.h"
+#include "csv_table.h"
+#include "csv_writer.h"
 
 namespace cckit
 {
 	struct csv_map
 	{
 		int rows, cols;
-		adjacency_list<std::string> graph;
-		std::vector<std::vector<adjacency_list_node<std::string>*> > nodes;
+		grid_graph<std::string> graph;// "X" cells are blocked
 		bool initialized;
+		grid_graph<std::string>::search_state searchState;// reused by every search()
 
 		csv_map(const char* _fileName);
 
 		void search(int _row, int _col, int _range);
-		void write(const char* _fileName);
+		// false if the file could not be opened or written completely
+		bool write(const char* _fileName, bool _background = false);
 	};
 }
 
 namespace cckit
 {
 	csv_map::csv_map(const char* _fileName)
-		: rows(0), cols(0), graph(), nodes(), initialized(false)
+		: rows(0), cols(0), graph(), initialized(false), searchState()
 	{
-		std::ifstream ifs0(_fileName); if (!ifs0.is_open()) return; initialized = true;
-		std::string str0;
+		csv_table table(_fileName); if (!table.is_open()) return; initialized = true;
+		rows = static_cast<int>(table.rows());
+		cols = static_cast<int>(table.cols());
 
-		for (int cols0 = 0; std::getline(ifs0, str0); ++rows, cols0 = 0) {
-			nodes.push_back(decltype(nodes)::value_type());
-			std::istringstream iss0(str0);
-			for (; std::getline(iss0, str0, ','); ++cols0, nodes[rows].push_back(graph.add_vertex(str0)));
-			if (cols < cols0)
-				cols = cols0;
-		}
-		for (int row = 0; row < rows; ++row)
-			for (int col = nodes[row].size(); col < cols; ++col, nodes[row].push_back(graph.add_vertex("X")));
-
-		for (int row = 0; row < rows; ++row) {
-			for (int col = 0; col < nodes[row].size(); ++col) {
-				auto SetEdge
-					= [this](adjacency_list_node<std::string>* _head
-						, adjacency_list_node<std::string>* _tail) {
-					graph.set_edge(_head, _tail, (_tail->value() == "X") ? -1 : 1);
-				};
-				if (row != 0)
-					SetEdge(nodes[row][col], nodes[row - 1][col]);
-				if (row < rows - 1)
-					SetEdge(nodes[row][col], nodes[row + 1][col]);
-				if (col != 0)
-					SetEdge(nodes[row][col], nodes[row][col - 1]);
-				if (col != nodes[row].size() - 1)
-					SetEdge(nodes[row][col], nodes[row][col + 1]);
+		// cells missing from short rows are padded as "X"
+		graph.assign(rows, cols, "X");
+		for (int col = 0; col < cols; ++col) {
+			const csv_field* column = table.column(col);
+			for (int row = 0; row < rows; ++row) {
+				auto vertex = graph.index(row, col);
+				if (static_cast<size_t>(col) < table.row_size(row)) {
+					graph.set_value(vertex, column[row].str());
+					graph.set_blocked(vertex, column[row] == "X");
+				}
+				else
+					graph.set_blocked(vertex, true);
 			}
 		}
-
-		ifs0.close();
 	}
 
 	void csv_map::search(int _row, int _col, int _range)
 	{
 		assert(_row < rows && _col < cols);
 
-		graph.bfsearch(nodes[_row][_col], _range, [](cckit::adjacency_list_node<std::string>* _arg) {
-			_arg->set_value("S");
-		}, [](cckit::adjacency_list_node<std::string>* _arg) {
-			_arg->set_value("R");
+		graph.bfsearch(searchState, graph.index(_row, _col), _range, [this](grid_graph<std::string>::vertex_type _arg) {
+			graph.set_value(_arg, "S");
+		}, [this](grid_graph<std::string>::vertex_type _arg) {
+			graph.set_value(_arg, "R");
 		});
 	}
 
-	void csv_map::write(const char* _fileName)
+	bool csv_map::write(const char* _fileName, bool _background)
 	{
-		std::ofstream ofs0(_fileName); if (!ofs0.is_open()) return;
-		for (int row = 0; row < rows; ++row, ofs0 << "\n") {
-			for (int col = 0; col < nodes[row].size(); ++col) {
-				ofs0 << nodes[row][col]->value() << ",";
+		csv_writer writer(_fileName, 1 << 22, _background); if (!writer.is_open()) return false;
+		for (int row = 0; row < rows; ++row, writer.end_row()) {
+			for (int col = 0; col < cols; ++col) {
+				writer.field(graph.value(graph.index(row, col)));
 			}
 		}
-
-		ofs0.close();
+		writer.flush();
+		return writer.good();
 	}
 }
 
@@ -0,0 +1,187 @@
+#ifndef CCKIT_CSV_STREAM_MAP_H
+#define CCKIT_CSV_STREAM_MAP_H
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include "../internal/config.h"
+#include "csv_table.h"
+#include "csv_writer.h"
+
+namespace cckit
+{
+	/*
+	A csv_map for grids that do not fit in memory. The constructor maps the file and records where every row begins;
+	cells are only tokenized a band of rows at a time when write() streams the result out. search() just queues the
+	query. For each band, write() loads a window with halo rows above and below it. The halo is twice the largest queued
+	range. That is enough to run every queued search that can reach the band to completion, in the order the searches
+	were made. So the output matches csv_map::search() followed by csv_map::write(). Memory stays bounded by
+	(band_rows + 4 * range) * cols cells plus one offset per row, however large the file is.
+	*/
+	class csv_stream_map
+	{
+		typedef csv_stream_map this_type;
+	public:
+		explicit csv_stream_map(const char* _fileName, int _bandRows = 4096);
+
+		int rows() const { return mRowOffsets.empty() ? 0 : static_cast<int>(mRowOffsets.size()) - 1; }
+		int cols() const { return mCols; }
+		bool initialized() const { return mFile.is_open(); }
+
+		void search(int _row, int _col, int _range);
+		// false if the file could not be opened or written completely
+		bool write(const char* _fileName, bool _background = false);
+
+	private:
+		struct Search
+		{
+			int mRow;
+			int mCol;
+			int mRange;
+		};
+
+		void LoadWindow(int _first, int _last);
+		void RunSearch(const Search& _search);
+		size_t Cell(int _row, int _col) const { return static_cast<size_t>(_row - mWindowFirst) * mCols + _col; }
+
+	private:
+		mapped_file mFile;
+		std::vector<const char*> mRowOffsets;// rows() + 1 entries, the last one is the end of the file
+		std::vector<Search> mSearches;
+		int mCols;
+		int mBandRows;
+		int mMaxRange;
+
+		// the rows [mWindowFirst, mWindowLast) currently loaded
+		int mWindowFirst;
+		int mWindowLast;
+		std::vector<csv_field> mCells;
+		std::vector<char> mMarks;// 'S' or 'R' where a search has been, 0 elsewhere
+		std::vector<uint32_t> mStamps;
+		std::vector<std::pair<size_t, int> > mQueue;// cell index into the window and hop distance
+		uint32_t mEpoch;
+	};
+}
+
+namespace cckit
+{
+	inline csv_stream_map::csv_stream_map(const char* _fileName, int _bandRows)
+		: mFile(_fileName), mRowOffsets(), mSearches(), mCols(0), mBandRows(_bandRows > 0 ? _bandRows : 1), mMaxRange(0)
+		, mWindowFirst(0), mWindowLast(0), mCells(), mMarks(), mStamps(), mQueue(), mEpoch(0)
+	{
+		if (!initialized()) return;
+
+		const char* first = mFile.data();
+		const char* last = first + mFile.size();
+		int rowSize = 0;
+		mRowOffsets.push_back(first);
+		CsvForEachField(first, last, [&rowSize](const char*, const char*) { ++rowSize; }
+			, [this, &rowSize](const char* _next) {
+			mRowOffsets.push_back(_next);
+			if (mCols < rowSize) mCols = rowSize;
+			rowSize = 0;
+		});
+	}
+
+	inline void csv_stream_map::search(int _row, int _col, int _range)
+	{
+		assert(_row < rows() && _col < cols());
+
+		Search query = { _row, _col, _range };
+		mSearches.push_back(query);
+		if (mMaxRange < _range)
+			mMaxRange = _range;
+	}
+
+	inline bool csv_stream_map::write(const char* _fileName, bool _background)
+	{
+		csv_writer writer(_fileName, 1 << 22, _background); if (!writer.is_open()) return false;
+
+		int halo = 2 * mMaxRange;
+		for (int bandFirst = 0; bandFirst < rows(); bandFirst += mBandRows) {
+			int bandLast = (rows() - bandFirst < mBandRows) ? rows() : bandFirst + mBandRows;
+			LoadWindow(bandFirst - halo, bandLast + halo);
+
+			for (auto current = mSearches.cbegin(), end = mSearches.cend(); current != end; ++current)
+				if (current->mRow + current->mRange >= bandFirst && current->mRow - current->mRange < bandLast)
+					RunSearch(*current);
+
+			for (int row = bandFirst; row < bandLast; ++row, writer.end_row()) {
+				for (int col = 0; col < mCols; ++col) {
+					char mark = mMarks[Cell(row, col)];
+					const csv_field& cell = mCells[Cell(row, col)];
+					if (mark)
+						writer.field(mark);
+					else
+						writer.field(cell.data, cell.size);
+				}
+			}
+		}
+		writer.flush();
+		return writer.good();
+	}
+
+	// tokenizes the rows [_first, _last), clamped to the grid; cells missing from short rows read as "X"
+	inline void csv_stream_map::LoadWindow(int _first, int _last)
+	{
+		mWindowFirst = (_first < 0) ? 0 : _first;
+		mWindowLast = (_last > rows()) ? rows() : _last;
+		size_t cellCount = static_cast<size_t>(mWindowLast - mWindowFirst) * mCols;
+
+		static const char blocked[] = "X";
+		const csv_field missing = { blocked, 1 };
+		mCells.assign(cellCount, missing);
+		mMarks.assign(cellCount, 0);
+		if (mStamps.size() < cellCount)
+			mStamps.resize(cellCount, 0);
+
+		size_t rowIndex = 0, index = 0;
+		CsvForEachField(mRowOffsets[mWindowFirst], mRowOffsets[mWindowLast]
+			, [this, &index](const char* _first, const char* _last) {
+			csv_field field = { _first, static_cast<size_t>(_last - _first) };
+			mCells[index++] = field;
+		}, [this, &rowIndex, &index](const char*) { index = ++rowIndex * mCols; });
+	}
+
+	// the same breadth first search csv_map runs over its adjacency_list, on the 4-neighborhood of the window
+	inline void csv_stream_map::RunSearch(const Search& _search)
+	{
+		if (++mEpoch == 0) {
+			std::fill(mStamps.begin(), mStamps.end(), 0);
+			mEpoch = 1;
+		}
+
+		size_t windowRows = static_cast<size_t>(mWindowLast - mWindowFirst), cols = static_cast<size_t>(mCols);
+		size_t src = Cell(_search.mRow, _search.mCol);
+		mQueue.clear();
+		mQueue.push_back(std::make_pair(src, 0));
+		mStamps[src] = mEpoch;
+		mMarks[src] = 'S';
+
+		for (size_t head = 0; head < mQueue.size(); ++head) {
+			size_t cell = mQueue[head].first;
+			int distance = mQueue[head].second;
+			if (distance >= _search.mRange) return;
+
+			// npos stands for a neighbor off the window
+			const size_t npos = ~size_t(0);
+			size_t row = cell / cols, col = cell - row * cols;
+			size_t neighbors[4] = {
+				(row != 0) ? cell - cols : npos,
+				(row + 1 < windowRows) ? cell + cols : npos,
+				(col != 0) ? cell - 1 : npos,
+				(col + 1 < cols) ? cell + 1 : npos
+			};
+			for (int i = 0; i < 4; ++i) {
+				size_t adjacent = neighbors[i];
+				if (adjacent == npos || mStamps[adjacent] == mEpoch || mCells[adjacent] == "X") continue;
+				mStamps[adjacent] = mEpoch;
+				mMarks[adjacent] = 'R';
+				mQueue.push_back(std::make_pair(adjacent, distance + 1));
+			}
+		}
+	}
+}
+
+#endif // !CCKIT_CSV_STREAM_MAP_H
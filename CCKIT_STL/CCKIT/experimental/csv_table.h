@@ -0,0 +1,225 @@
+#ifndef CCKIT_CSV_TABLE_H
+#define CCKIT_CSV_TABLE_H
+
+#include "../internal/config.h"
+#include "../internal/bit_scan.h"
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#ifdef CCKIT_SSE2
+#include <emmintrin.h>
+#endif // CCKIT_SSE2
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace cckit
+{
+	// a read-only memory mapping of a whole file; an empty file is open with size() 0
+	class mapped_file
+	{
+		typedef mapped_file this_type;
+	public:
+		explicit mapped_file(const char* _fileName);
+		~mapped_file();
+		mapped_file(const this_type&) = delete;
+		this_type& operator=(const this_type&) = delete;
+
+		bool is_open() const { return mOpen; }
+		const char* data() const { return mpData; }
+		size_t size() const { return mSize; }
+
+	private:
+#ifdef _WIN32
+		HANDLE mFile;
+		HANDLE mMapping;
+#else
+		int mFile;
+#endif // _WIN32
+		const char* mpData;
+		size_t mSize;
+		bool mOpen;
+	};
+
+	// a field of a csv_table, pointing into the mapped file instead of owning a copy
+	struct csv_field
+	{
+		const char* data;
+		size_t size;
+
+		std::string str() const { return std::string(data, size); }
+		bool operator==(const char* _str) const { return std::strlen(_str) == size && std::memcmp(data, _str, size) == 0; }
+		bool operator!=(const char* _str) const { return !(*this == _str); }
+	};
+
+	// calls _onField(first, last) for every field of [_first, _last) and _onRow(next) at the end of every row, where next
+	// is the beginning of the following row
+	template<typename FieldFunction, typename RowFunction>
+	void CsvForEachField(const char* _first, const char* _last, FieldFunction _onField, RowFunction _onRow);
+
+	/*
+	A comma separated file, mapped into memory and split into fields without copying them. The delimiters are located 16
+	bytes at a time with SSE2 where available. A first pass only counts the fields of every row, so that a second pass can
+	store them column by column: field(row, col) of one column are adjacent, and a row shorter than cols() reads as
+	empty fields past row_size(row).
+
+	As with std::getline, an empty last field of a row is dropped, so "a,b," has two fields and an empty line none. A
+	carriage return before a line feed is not part of the last field. Quoting is not interpreted.
+	*/
+	class csv_table
+	{
+		typedef csv_table this_type;
+	public:
+		explicit csv_table(const char* _fileName);
+
+		bool is_open() const { return mFile.is_open(); }
+		size_t rows() const { return mRowSizes.size(); }
+		size_t cols() const { return mCols; }
+		size_t row_size(size_t _row) const { return mRowSizes[_row]; }
+		const csv_field& field(size_t _row, size_t _col) const { return mFields[_col * rows() + _row]; }
+		// the rows() fields of column _col
+		const csv_field* column(size_t _col) const { return mFields.data() + _col * rows(); }
+
+	private:
+		mapped_file mFile;
+		std::vector<uint32_t> mRowSizes;
+		std::vector<csv_field> mFields;
+		size_t mCols;
+	};
+}
+
+namespace cckit
+{
+	inline mapped_file::mapped_file(const char* _fileName)
+#ifdef _WIN32
+		: mFile(INVALID_HANDLE_VALUE), mMapping(nullptr), mpData(nullptr), mSize(0), mOpen(false)
+	{
+		mFile = CreateFileA(_fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (mFile == INVALID_HANDLE_VALUE) return;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFile, &size)) return;
+		mSize = static_cast<size_t>(size.QuadPart);
+		mOpen = true;
+		if (mSize == 0) return;
+		mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mMapping)
+			mpData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+		if (!mpData) {
+			mSize = 0;
+			mOpen = false;
+		}
+	}
+#else
+		: mFile(-1), mpData(nullptr), mSize(0), mOpen(false)
+	{
+		mFile = open(_fileName, O_RDONLY);
+		if (mFile < 0) return;
+		struct stat status;
+		if (fstat(mFile, &status) != 0) return;
+		mSize = static_cast<size_t>(status.st_size);
+		mOpen = true;
+		if (mSize == 0) return;
+		void* pData = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+		if (pData == MAP_FAILED) {
+			mSize = 0;
+			mOpen = false;
+			return;
+		}
+		madvise(pData, mSize, MADV_SEQUENTIAL);
+		mpData = static_cast<const char*>(pData);
+	}
+#endif // _WIN32
+
+	inline mapped_file::~mapped_file()
+	{
+#ifdef _WIN32
+		if (mpData) UnmapViewOfFile(mpData);
+		if (mMapping) CloseHandle(mMapping);
+		if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+#else
+		if (mpData) munmap(const_cast<char*>(mpData), mSize);
+		if (mFile >= 0) close(mFile);
+#endif // _WIN32
+	}
+
+	inline csv_table::csv_table(const char* _fileName)
+		: mFile(_fileName), mRowSizes(), mFields(), mCols(0)
+	{
+		if (!is_open()) return;
+
+		const char* first = mFile.data();
+		const char* last = first + mFile.size();
+		uint32_t rowSize = 0;
+		CsvForEachField(first, last, [&rowSize](const char*, const char*) { ++rowSize; }
+			, [this, &rowSize](const char*) {
+			mRowSizes.push_back(rowSize);
+			if (mCols < rowSize) mCols = rowSize;
+			rowSize = 0;
+		});
+
+		const csv_field missing = { nullptr, 0 };
+		mFields.assign(rows() * mCols, missing);
+		size_t row = 0, index = 0;// index walks down the columns of the current row
+		size_t rowCount = rows();
+		CsvForEachField(first, last, [this, &index, rowCount](const char* _first, const char* _last) {
+			csv_field& field = mFields[index];
+			field.data = _first;
+			field.size = _last - _first;
+			index += rowCount;
+		}, [&row, &index](const char*) { index = ++row; });
+	}
+
+	template<typename FieldFunction, typename RowFunction>
+	void CsvForEachField(const char* _first, const char* _last, FieldFunction _onField, RowFunction _onRow)
+	{
+		const char* fieldFirst = _first;
+		bool rowOpen = false;
+
+		auto OnDelimiter = [&](const char* _delimiter) {
+			if (*_delimiter == ',') {
+				_onField(fieldFirst, _delimiter);
+				rowOpen = true;
+			}
+			else {
+				const char* fieldLast = (_delimiter != fieldFirst && _delimiter[-1] == '\r') ? _delimiter - 1 : _delimiter;
+				if (fieldLast != fieldFirst)
+					_onField(fieldFirst, fieldLast);
+				_onRow(_delimiter + 1);
+				rowOpen = false;
+			}
+			fieldFirst = _delimiter + 1;
+		};
+
+		const char* current = _first;
+#ifdef CCKIT_SSE2
+		const __m128i comma = _mm_set1_epi8(',');
+		const __m128i lineFeed = _mm_set1_epi8('\n');
+		for (; _last - current >= 16; current += 16) {
+			__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(current));
+			unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, lineFeed))));
+			for (; mask; mask &= mask - 1)
+				OnDelimiter(current + lowest_bit_index(mask));
+		}
+#endif // CCKIT_SSE2
+		for (; current != _last; ++current)
+			if (*current == ',' || *current == '\n')
+				OnDelimiter(current);
+
+		// the last line need not end with a line feed
+		if (fieldFirst != _last || rowOpen) {
+			const char* fieldLast = (_last != fieldFirst && _last[-1] == '\r') ? _last - 1 : _last;
+			if (fieldLast != fieldFirst)
+				_onField(fieldFirst, fieldLast);
+			_onRow(_last);
+		}
+	}
+}
+
+#endif // !CCKIT_CSV_TABLE_H
@@ -0,0 +1,176 @@
+#ifndef CCKIT_CSV_WRITER_H
+#define CCKIT_CSV_WRITER_H
+
+#include "../internal/config.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+namespace cckit
+{
+	/*
+	Writes comma separated rows through a large byte buffer that goes to the file in a single unbuffered fwrite whenever
+	it fills up, so a multi-GB file takes a few thousand system calls and no per-field stream formatting. Rows end in
+	"\r\n" on Windows and in '\n' elsewhere, as a text mode stream would write them.
+
+	"_background"
+	Hands every full buffer to a writer thread and keeps filling a second one meanwhile, so that formatting the next
+	rows overlaps with the disk write of the previous ones.
+	*/
+	class csv_writer
+	{
+		typedef csv_writer this_type;
+	public:
+		explicit csv_writer(const char* _fileName, size_t _bufferSize = 1 << 22, bool _background = false);
+		~csv_writer();
+		csv_writer(const this_type&) = delete;
+		this_type& operator=(const this_type&) = delete;
+
+		bool is_open() const { return mpFile != nullptr; }
+		// false once some write fell short, e.g. on a full disk; call after flush() to cover everything appended
+		bool good() const { return is_open() && !mFailed; }
+
+		// appends _size bytes followed by a comma, as csv_map::write always did
+		void field(const char* _data, size_t _size) { append(_data, _size); put(','); }
+		void field(const std::string& _str) { field(_str.data(), _str.size()); }
+		void field(char _ch) { put(_ch); put(','); }
+		void end_row() {
+#ifdef _WIN32
+			put('\r');
+#endif // _WIN32
+			put('\n');
+		}
+
+		void append(const char* _data, size_t _size);
+		void put(char _ch) {
+			if (mSize == mBuffer.size()) Submit();
+			mBuffer[mSize++] = _ch;
+		}
+		// writes out everything appended so far
+		void flush();
+
+	private:
+		void Submit();
+		void WriterLoop();
+
+	private:
+		std::FILE* mpFile;
+		std::vector<char> mBuffer;
+		size_t mSize;
+		std::atomic<bool> mFailed;// set by whichever thread writes
+
+		// the buffer handed to the writer thread; mPendingSize is 0 while the thread is idle
+		std::thread mWriter;
+		std::mutex mMutex;
+		std::condition_variable mCondition;
+		std::vector<char> mPending;
+		size_t mPendingSize;
+		bool mStop;
+	};
+}
+
+namespace cckit
+{
+	inline csv_writer::csv_writer(const char* _fileName, size_t _bufferSize, bool _background)
+		: mpFile(nullptr), mBuffer(_bufferSize > 0 ? _bufferSize : 1), mSize(0), mFailed(false)
+		, mWriter(), mMutex(), mCondition(), mPending(), mPendingSize(0), mStop(false)
+	{
+#ifdef _MSC_VER
+		if (fopen_s(&mpFile, _fileName, "wb") != 0) mpFile = nullptr;
+#else
+		mpFile = std::fopen(_fileName, "wb");
+#endif // _MSC_VER
+		if (!mpFile) return;
+		// the buffer is ours already, a second one inside the C library would only add a copy
+		std::setvbuf(mpFile, nullptr, _IONBF, 0);
+
+		if (_background) {
+			mPending.resize(mBuffer.size());
+			mWriter = std::thread([this]() { WriterLoop(); });
+		}
+	}
+
+	inline csv_writer::~csv_writer()
+	{
+		if (!mpFile) return;
+		flush();
+		if (mWriter.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mStop = true;
+			}
+			mCondition.notify_all();
+			mWriter.join();
+		}
+		std::fclose(mpFile);
+	}
+
+	inline void csv_writer::append(const char* _data, size_t _size)
+	{
+		while (_size > 0) {
+			if (mSize == mBuffer.size()) Submit();
+			size_t count = mBuffer.size() - mSize;
+			if (count > _size) count = _size;
+			std::memcpy(mBuffer.data() + mSize, _data, count);
+			mSize += count;
+			_data += count;
+			_size -= count;
+		}
+	}
+
+	inline void csv_writer::flush()
+	{
+		if (!mpFile) return;
+		if (mSize > 0) Submit();
+		if (mWriter.joinable()) {
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this]() { return mPendingSize == 0; });
+		}
+	}
+
+	// either writes the filled buffer right away or swaps it with the writer thread's one once that is done
+	inline void csv_writer::Submit()
+	{
+		if (!mpFile) {
+			mSize = 0;
+			return;
+		}
+		if (!mWriter.joinable()) {
+			if (std::fwrite(mBuffer.data(), 1, mSize, mpFile) != mSize)
+				mFailed = true;
+			mSize = 0;
+			return;
+		}
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this]() { return mPendingSize == 0; });
+			mBuffer.swap(mPending);
+			mPendingSize = mSize;
+		}
+		mCondition.notify_all();
+		mSize = 0;
+	}
+
+	inline void csv_writer::WriterLoop()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		for (;;) {
+			mCondition.wait(lock, [this]() { return mStop || mPendingSize != 0; });
+			if (mPendingSize == 0) return;// stopped with nothing left to write
+			size_t size = mPendingSize;
+			lock.unlock();
+			if (std::fwrite(mPending.data(), 1, size, mpFile) != size)
+				mFailed = true;
+			lock.lock();
+			mPendingSize = 0;
+			mCondition.notify_all();
+		}
+	}
+}
+
+#endif // !CCKIT_CSV_WRITER_H
@@ -6,11 +6,17 @@
 #include "../queue.h"
 #include "../algorithm.h"
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <utility>
+#include <cstdint>
 
 namespace cckit
 {
 	template<typename T>
 	class adjacency_list;
+	template<typename T>
+	class csr_graph;
 
 	template<typename T>
 	class adjacency_list_node
@@ -20,7 +26,7 @@ namespace cckit
 		typedef T value_type;
 
 	private:
-		explicit adjacency_list_node(const value_type& _val = value_type());
+		explicit adjacency_list_node(const value_type& _val = value_type(), uint32_t _id = 0);
 	public:
 		const value_type& value() const;
 		void set_value(const value_type& _val);
@@ -28,12 +34,12 @@ namespace cckit
 	private:
 		std::unordered_map<this_type*, int> mAdjacencyMap;
 		value_type mVal;
-		this_type* mpPredecessor;
-		bool mVisited;
-		int mDistance;
+		uint32_t mId;// position in add_vertex order, indexes the visit marks of a search_state
 
 		template<typename T>
 		friend class adjacency_list;
+		template<typename U>
+		friend class csr_graph;
 	};
 
 	template<typename T>
@@ -44,6 +50,23 @@ namespace cckit
 		typedef T value_type;
 		typedef adjacency_list_node<T> node_type;
 
+		/*
+		The visit marks of a search, kept apart from the graph so that searches on one graph can run concurrently. Each
+		thread reuses its own search_state across queries: the marks are stamped with a query number instead of being
+		cleared, so a search only costs time in the vertices it reaches.
+		*/
+		class search_state
+		{
+		public:
+			search_state() : mStamps(), mQueue(), mEpoch(0) {}
+		private:
+			std::vector<uint32_t> mStamps;
+			std::vector<std::pair<node_type*, int> > mQueue;// reached vertices and their hop distances
+			uint32_t mEpoch;
+
+			friend class adjacency_list;
+		};
+
 	public:
 		adjacency_list();
 		~adjacency_list();
@@ -52,21 +75,91 @@ namespace cckit
 		void set_edge(node_type* _head, node_type* _tail, int _weight);
 		bool is_edge(node_type* _head, node_type* _tail) const;
 
+		// these overloads track the visited vertices in a hash set of their own
 		template<typename UnaryFunction>
 		void bfsearch(node_type* _src, int _range, UnaryFunction _func) const;
 		template<typename UnaryFunction0, typename UnaryFunction1>
 		void bfsearch(node_type* _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const;
+		template<typename UnaryFunction>
+		void bfsearch(search_state& _state, node_type* _src, int _range, UnaryFunction _func) const;
+		template<typename UnaryFunction0, typename UnaryFunction1>
+		void bfsearch(search_state& _state, node_type* _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const;
+
+	private:
+		template<typename Mark, typename UnaryFunction0, typename UnaryFunction1>
+		void Bfsearch(std::vector<std::pair<node_type*, int> >& _queue, Mark _mark
+			, node_type* _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const;
 
 	private:
 		list<node_type*> mVertices;
+
+		template<typename U>
+		friend class csr_graph;
+	};
+
+	struct csr_edge
+	{
+		uint32_t source;
+		uint32_t target;
+		int weight;
+	};
+
+	/*
+	An immutable graph in compressed sparse row form. The out-edges of vertex v occupy the index range
+	[edge_begin(v), edge_end(v)) of two parallel arrays, one of targets and one of weights, so a traversal streams through
+	contiguous memory instead of following a hash map bucket per edge. Vertices are 32-bit ids in [0, vertex_count()).
+
+	When built from an adjacency_list, ids follow the order in which add_vertex() was called and edges of weight -1 are
+	dropped, as adjacency_list::is_edge() does not count them either.
+	*/
+	template<typename T>
+	class csr_graph
+	{
+		typedef csr_graph<T> this_type;
+	public:
+		typedef T value_type;
+		typedef uint32_t vertex_type;
+		typedef int weight_type;
+		typedef size_t size_type;
+
+	public:
+		explicit csr_graph(const adjacency_list<T>& _graph);
+		template<typename InputIterator>
+		csr_graph(size_type _vertexCount, InputIterator _first, InputIterator _last);
+
+		size_type vertex_count() const { return mValues.size(); }
+		size_type edge_count() const { return mTargets.size(); }
+		const value_type& value(vertex_type _vertex) const { return mValues[_vertex]; }
+
+		size_type edge_begin(vertex_type _vertex) const { return mOffsets[_vertex]; }
+		size_type edge_end(vertex_type _vertex) const { return mOffsets[_vertex + 1]; }
+		size_type degree(vertex_type _vertex) const { return mOffsets[_vertex + 1] - mOffsets[_vertex]; }
+		vertex_type target(size_type _edge) const { return mTargets[_edge]; }
+		weight_type weight(size_type _edge) const { return mWeights[_edge]; }
+		bool is_edge(vertex_type _head, vertex_type _tail) const;
+		this_type transposed() const;
+
+		template<typename UnaryFunction>
+		void bfsearch(vertex_type _src, int _range, UnaryFunction _func) const;
+		template<typename UnaryFunction0, typename UnaryFunction1>
+		void bfsearch(vertex_type _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const;
+
+	private:
+		void Build(const std::vector<csr_edge>& _edges);
+
+	private:
+		std::vector<uint32_t> mOffsets;// vertex_count() + 1 entries
+		std::vector<vertex_type> mTargets;
+		std::vector<weight_type> mWeights;
+		std::vector<value_type> mValues;
 	};
 }
 
 namespace cckit
 {
 	template<typename T>
-	inline adjacency_list_node<T>::adjacency_list_node(const value_type& _val)
-		: mAdjacencyMap(), mVal(_val), mpPredecessor(nullptr), mVisited(false), mDistance(0)
+	inline adjacency_list_node<T>::adjacency_list_node(const value_type& _val, uint32_t _id)
+		: mAdjacencyMap(), mVal(_val), mId(_id)
 	{}
 
 	template<typename T>
@@ -102,7 +195,7 @@ namespace cckit
 	inline typename adjacency_list<T>::node_type*
 		adjacency_list<T>::add_vertex(const value_type& _val)
 	{
-		mVertices.push_back(new node_type(_val));
+		mVertices.push_back(new node_type(_val, static_cast<uint32_t>(mVertices.size())));
 		return mVertices.back();
 	}
 
@@ -115,7 +208,8 @@ namespace cckit
 	template<typename T>
 	inline bool adjacency_list<T>::is_edge(node_type* _head, node_type* _tail) const
 	{
-		return _head->mAdjacencyMap[_tail] != -1;
+		auto edge = _head->mAdjacencyMap.find(_tail);
+		return edge != _head->mAdjacencyMap.end() && edge->second != -1;
 	}
 
 	template<typename T>
@@ -129,34 +223,184 @@ namespace cckit
 	template<typename UnaryFunction0, typename UnaryFunction1>
 	void adjacency_list<T>::bfsearch(node_type* _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const
 	{
-		queue<node_type*> queue;
+		std::unordered_set<const node_type*> visited;
+		std::vector<std::pair<node_type*, int> > queue;
+		Bfsearch(queue, [&visited](const node_type* _arg) {
+			return visited.insert(_arg).second;
+		}, _src, _range, _func0, _func1);
+	}
+
+	template<typename T>
+	template<typename UnaryFunction>
+	void adjacency_list<T>::bfsearch(search_state& _state, node_type* _src, int _range, UnaryFunction _func) const
+	{
+		bfsearch(_state, _src, _range, [](node_type*) {}, _func);
+	}
 
-		queue.push(_src);
-		cckit::for_each(mVertices.begin(), mVertices.cend(), [](node_type* _arg) {
-			_arg->mVisited = false;
-			_arg->mDistance = 0;
-		});
-		_src->mVisited = true;
+	template<typename T>
+	template<typename UnaryFunction0, typename UnaryFunction1>
+	void adjacency_list<T>::bfsearch(search_state& _state, node_type* _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const
+	{
+		// vertices added since the last search get fresh stamps, and a wrapped epoch could match stale ones
+		if (_state.mStamps.size() < mVertices.size())
+			_state.mStamps.resize(mVertices.size(), 0);
+		if (++_state.mEpoch == 0) {
+			cckit::fill(_state.mStamps.begin(), _state.mStamps.end(), 0);
+			_state.mEpoch = 1;
+		}
+
+		uint32_t* stamps = _state.mStamps.data();
+		uint32_t epoch = _state.mEpoch;
+		Bfsearch(_state.mQueue, [stamps, epoch](const node_type* _arg) {
+			if (stamps[_arg->mId] == epoch) return false;
+			stamps[_arg->mId] = epoch;
+			return true;
+		}, _src, _range, _func0, _func1);
+	}
+
+	// _mark(v) marks v as visited and tells whether it was not visited yet. The queue is consumed by an advancing head
+	// rather than popped, so a reused queue keeps its capacity across searches.
+	template<typename T>
+	template<typename Mark, typename UnaryFunction0, typename UnaryFunction1>
+	void adjacency_list<T>::Bfsearch(std::vector<std::pair<node_type*, int> >& _queue, Mark _mark
+		, node_type* _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const
+	{
+		_queue.clear();
+		_queue.push_back(std::make_pair(_src, 0));
+		_mark(_src);
 		_func0(_src);
 
-		do {
-			node_type* currentNode = queue.front();
-			queue.pop();
-			if (currentNode->mDistance >= _range) return;
+		for (size_t head = 0; head < _queue.size(); ++head) {
+			node_type* currentNode = _queue[head].first;
+			int distance = _queue[head].second;
+			if (distance >= _range) return;
 
-			auto end = currentNode->mAdjacencyMap.end();
-			for (auto current = currentNode->mAdjacencyMap.begin(); current != end; ++current) {
-				auto adjacentNode = current->first;
-				if (!adjacentNode->mVisited && is_edge(currentNode, adjacentNode)) {
-					adjacentNode->mpPredecessor = currentNode;
-					adjacentNode->mVisited = true;
-					adjacentNode->mDistance = currentNode->mDistance + 1;
-					queue.push(adjacentNode);
+			auto end = currentNode->mAdjacencyMap.cend();
+			for (auto current = currentNode->mAdjacencyMap.cbegin(); current != end; ++current) {
+				node_type* adjacentNode = current->first;
+				if (current->second != -1 && _mark(adjacentNode)) {
+					_queue.push_back(std::make_pair(adjacentNode, distance + 1));
 
 					_func1(adjacentNode);
 				}
 			}
-		} while (!queue.empty());
+		}
+	}
+
+	template<typename T>
+	inline csr_graph<T>::csr_graph(const adjacency_list<T>& _graph)
+		: mOffsets(), mTargets(), mWeights(), mValues()
+	{
+		mValues.reserve(_graph.mVertices.size());
+		for (auto current = _graph.mVertices.cbegin(), end = _graph.mVertices.cend(); current != end; ++current)
+			mValues.push_back((*current)->mVal);
+
+		std::vector<csr_edge> edges;
+		for (auto current = _graph.mVertices.cbegin(), end = _graph.mVertices.cend(); current != end; ++current) {
+			vertex_type source = (*current)->mId;
+			for (auto it = (*current)->mAdjacencyMap.cbegin(), itEnd = (*current)->mAdjacencyMap.cend(); it != itEnd; ++it) {
+				if (it->second == -1) continue;
+				csr_edge edge = { source, it->first->mId, it->second };
+				edges.push_back(edge);
+			}
+		}
+		Build(edges);
+	}
+
+	template<typename T>
+	template<typename InputIterator>
+	inline csr_graph<T>::csr_graph(size_type _vertexCount, InputIterator _first, InputIterator _last)
+		: mOffsets(), mTargets(), mWeights(), mValues(_vertexCount)
+	{
+		std::vector<csr_edge> edges(_first, _last);
+		Build(edges);
+	}
+
+	template<typename T>
+	inline bool csr_graph<T>::is_edge(vertex_type _head, vertex_type _tail) const
+	{
+		for (size_type edge = edge_begin(_head), end = edge_end(_head); edge != end; ++edge)
+			if (mTargets[edge] == _tail)
+				return true;
+		return false;
+	}
+
+	// the same vertices with every edge reversed, e.g. for searches that run backwards from a target
+	template<typename T>
+	inline csr_graph<T> csr_graph<T>::transposed() const
+	{
+		std::vector<csr_edge> edges;
+		edges.reserve(edge_count());
+		for (vertex_type vertex = 0; vertex < vertex_count(); ++vertex) {
+			for (uint32_t edge = mOffsets[vertex], end = mOffsets[vertex + 1]; edge != end; ++edge) {
+				csr_edge reversed = { mTargets[edge], vertex, mWeights[edge] };
+				edges.push_back(reversed);
+			}
+		}
+		this_type result(*this);
+		result.Build(edges);
+		return result;
+	}
+
+	// counting sort by source: one pass for the degrees, a prefix sum for the offsets and one pass to scatter
+	template<typename T>
+	void csr_graph<T>::Build(const std::vector<csr_edge>& _edges)
+	{
+		size_type vertexCount = mValues.size();
+		mOffsets.assign(vertexCount + 1, 0);
+		for (auto current = _edges.cbegin(), end = _edges.cend(); current != end; ++current) {
+			assert((current->source < vertexCount && current->target < vertexCount));
+			++mOffsets[current->source + 1];
+		}
+		for (size_type i = 0; i < vertexCount; ++i)
+			mOffsets[i + 1] += mOffsets[i];
+
+		mTargets.resize(_edges.size());
+		mWeights.resize(_edges.size());
+		std::vector<uint32_t> cursors(mOffsets.begin(), mOffsets.end() - 1);
+		for (auto current = _edges.cbegin(), end = _edges.cend(); current != end; ++current) {
+			uint32_t slot = cursors[current->source]++;
+			mTargets[slot] = current->target;
+			mWeights[slot] = current->weight;
+		}
+	}
+
+	template<typename T>
+	template<typename UnaryFunction>
+	void csr_graph<T>::bfsearch(vertex_type _src, int _range, UnaryFunction _func) const
+	{
+		bfsearch(_src, _range, [](vertex_type) {}, _func);
+	}
+
+	// the visited flags and the queue are flat arrays indexed by vertex id; the queue never holds a vertex twice,
+	// so it is sized once and consumed by an advancing head instead of popping
+	template<typename T>
+	template<typename UnaryFunction0, typename UnaryFunction1>
+	void csr_graph<T>::bfsearch(vertex_type _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const
+	{
+		std::vector<int> distances(vertex_count(), -1);
+		std::vector<vertex_type> queue(vertex_count());
+		size_type head = 0, tail = 0;
+
+		queue[tail++] = _src;
+		distances[_src] = 0;
+		_func0(_src);
+
+		while (head != tail) {
+			vertex_type currentVertex = queue[head++];
+			int distance = distances[currentVertex];
+			if (distance >= _range) return;
+
+			for (uint32_t edge = mOffsets[currentVertex], end = mOffsets[currentVertex + 1]; edge != end; ++edge) {
+				vertex_type adjacentVertex = mTargets[edge];
+				if (distances[adjacentVertex] < 0) {
+					distances[adjacentVertex] = distance + 1;
+					queue[tail++] = adjacentVertex;
+
+					_func1(adjacentVertex);
+				}
+			}
+		}
 	}
 }
 #endif // !CCKIT_GRAPH_H
\ No newline at end of file
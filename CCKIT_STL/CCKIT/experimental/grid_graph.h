@@ -0,0 +1,185 @@
+#ifndef CCKIT_GRID_GRAPH_H
+#define CCKIT_GRID_GRAPH_H
+
+#include "../internal/config.h"
+#include "../algorithm.h"
+#include <unordered_set>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+namespace cckit
+{
+	/*
+	A graph over the cells of a rows x cols grid whose edges are implied rather than stored: every open cell is adjacent
+	to its 4 (or, with Connectivity 8, also its diagonal) open neighbors. Values and blocked flags live in flat row-major
+	arrays framed by a border of blocked cells, so the neighbors of a vertex are a fixed set of index offsets and a search
+	never has to check whether it is at the edge of the grid.
+
+	Vertices are indices into the framed arrays; index(), row() and col() convert between them and grid coordinates.
+	*/
+	template<typename T, int Connectivity = 4>
+	class grid_graph
+	{
+		static_assert(Connectivity == 4 || Connectivity == 8, "a grid cell has either 4 or 8 neighbors");
+		typedef grid_graph<T, Connectivity> this_type;
+	public:
+		typedef T value_type;
+		typedef uint32_t vertex_type;
+
+		// the visit marks of a search, reused across queries like adjacency_list::search_state
+		class search_state
+		{
+		public:
+			search_state() : mStamps(), mQueue(), mEpoch(0) {}
+		private:
+			std::vector<uint32_t> mStamps;
+			std::vector<std::pair<vertex_type, int> > mQueue;
+			uint32_t mEpoch;
+
+			friend class grid_graph;
+		};
+
+	public:
+		grid_graph() : grid_graph(0, 0) {}
+		grid_graph(int _rows, int _cols, const value_type& _val = value_type());
+
+		void assign(int _rows, int _cols, const value_type& _val = value_type());
+
+		int rows() const { return mRows; }
+		int cols() const { return mCols; }
+		vertex_type index(int _row, int _col) const { return static_cast<vertex_type>((_row + 1) * mStride + _col + 1); }
+		int row(vertex_type _vertex) const { return static_cast<int>(_vertex / mStride) - 1; }
+		int col(vertex_type _vertex) const { return static_cast<int>(_vertex % mStride) - 1; }
+
+		const value_type& value(vertex_type _vertex) const { return mValues[_vertex]; }
+		void set_value(vertex_type _vertex, const value_type& _val) { mValues[_vertex] = _val; }
+		bool blocked(vertex_type _vertex) const { return mBlocked[_vertex] != 0; }
+		void set_blocked(vertex_type _vertex, bool _blocked) { mBlocked[_vertex] = _blocked ? 1 : 0; }
+
+		// as adjacency_list::bfsearch; blocked cells are never entered, but a search may start from one
+		template<typename UnaryFunction>
+		void bfsearch(vertex_type _src, int _range, UnaryFunction _func) const;
+		template<typename UnaryFunction0, typename UnaryFunction1>
+		void bfsearch(vertex_type _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const;
+		template<typename UnaryFunction>
+		void bfsearch(search_state& _state, vertex_type _src, int _range, UnaryFunction _func) const;
+		template<typename UnaryFunction0, typename UnaryFunction1>
+		void bfsearch(search_state& _state, vertex_type _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const;
+
+	private:
+		template<typename Mark, typename UnaryFunction0, typename UnaryFunction1>
+		void Bfsearch(std::vector<std::pair<vertex_type, int> >& _queue, Mark _mark
+			, vertex_type _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const;
+
+	private:
+		int mRows;
+		int mCols;
+		int mStride;// mCols plus the two border columns
+		int mOffsets[Connectivity];
+		std::vector<value_type> mValues;
+		std::vector<uint8_t> mBlocked;
+	};
+}
+
+namespace cckit
+{
+	template<typename T, int Connectivity>
+	inline grid_graph<T, Connectivity>::grid_graph(int _rows, int _cols, const value_type& _val)
+		: mRows(0), mCols(0), mStride(0), mOffsets(), mValues(), mBlocked()
+	{
+		assign(_rows, _cols, _val);
+	}
+
+	template<typename T, int Connectivity>
+	void grid_graph<T, Connectivity>::assign(int _rows, int _cols, const value_type& _val)
+	{
+		mRows = _rows;
+		mCols = _cols;
+		mStride = _cols + 2;
+		size_t cellCount = static_cast<size_t>(_rows + 2) * mStride;
+		mValues.assign(cellCount, _val);
+		mBlocked.assign(cellCount, 1);
+		for (int row = 0; row < _rows; ++row)
+			cckit::fill(mBlocked.begin() + index(row, 0), mBlocked.begin() + index(row, 0) + _cols, uint8_t(0));
+
+		const int offsets[8] = { -mStride, mStride, -1, 1, -mStride - 1, -mStride + 1, mStride - 1, mStride + 1 };
+		for (int i = 0; i < Connectivity; ++i)
+			mOffsets[i] = offsets[i];
+	}
+
+	template<typename T, int Connectivity>
+	template<typename UnaryFunction>
+	void grid_graph<T, Connectivity>::bfsearch(vertex_type _src, int _range, UnaryFunction _func) const
+	{
+		bfsearch(_src, _range, [](vertex_type) {}, _func);
+	}
+
+	template<typename T, int Connectivity>
+	template<typename UnaryFunction0, typename UnaryFunction1>
+	void grid_graph<T, Connectivity>::bfsearch(vertex_type _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const
+	{
+		std::unordered_set<vertex_type> visited;
+		std::vector<std::pair<vertex_type, int> > queue;
+		Bfsearch(queue, [&visited](vertex_type _arg) {
+			return visited.insert(_arg).second;
+		}, _src, _range, _func0, _func1);
+	}
+
+	template<typename T, int Connectivity>
+	template<typename UnaryFunction>
+	void grid_graph<T, Connectivity>::bfsearch(search_state& _state, vertex_type _src, int _range, UnaryFunction _func) const
+	{
+		bfsearch(_state, _src, _range, [](vertex_type) {}, _func);
+	}
+
+	template<typename T, int Connectivity>
+	template<typename UnaryFunction0, typename UnaryFunction1>
+	void grid_graph<T, Connectivity>::bfsearch(search_state& _state, vertex_type _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const
+	{
+		if (_state.mStamps.size() < mBlocked.size())
+			_state.mStamps.resize(mBlocked.size(), 0);
+		if (++_state.mEpoch == 0) {
+			cckit::fill(_state.mStamps.begin(), _state.mStamps.end(), 0u);
+			_state.mEpoch = 1;
+		}
+
+		uint32_t* stamps = _state.mStamps.data();
+		uint32_t epoch = _state.mEpoch;
+		Bfsearch(_state.mQueue, [stamps, epoch](vertex_type _arg) {
+			if (stamps[_arg] == epoch) return false;
+			stamps[_arg] = epoch;
+			return true;
+		}, _src, _range, _func0, _func1);
+	}
+
+	template<typename T, int Connectivity>
+	template<typename Mark, typename UnaryFunction0, typename UnaryFunction1>
+	void grid_graph<T, Connectivity>::Bfsearch(std::vector<std::pair<vertex_type, int> >& _queue, Mark _mark
+		, vertex_type _src, int _range, UnaryFunction0 _func0, UnaryFunction1 _func1) const
+	{
+		_queue.clear();
+		_queue.push_back(std::make_pair(_src, 0));
+		_mark(_src);
+		_func0(_src);
+
+		const uint8_t* blocked = mBlocked.data();
+		for (size_t head = 0; head < _queue.size(); ++head) {
+			vertex_type vertex = _queue[head].first;
+			int distance = _queue[head].second;
+			if (distance >= _range) return;
+
+			// the border is blocked, so every offset stays inside the framed arrays
+			for (int i = 0; i < Connectivity; ++i) {
+				vertex_type adjacent = static_cast<vertex_type>(static_cast<int>(vertex) + mOffsets[i]);
+				if (!blocked[adjacent] && _mark(adjacent)) {
+					_queue.push_back(std::make_pair(adjacent, distance + 1));
+
+					_func1(adjacent);
+				}
+			}
+		}
+	}
+}
+
+#endif // !CCKIT_GRID_GRAPH_H
@@ -1,10 +1,9 @@
 #include <set>
-#include <unordered_map>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <cstdint>
 #include "../stack.h"
-#include "../queue.h"
 #include "../random.h"
 
 using std::endl;
@@ -144,16 +143,22 @@ namespace cckit
 		}
 	};
 
+	// distances from root, flat and indexed by row * cols + col; -1 marks cells that were not reached
 	struct distances
 	{
 		cell* root;
-		std::unordered_map<cell*, int> distmap;
+		int cols;
+		std::vector<int> distmap;
 
-		distances(cell* _root)
-			: root(_root)
+		distances(cell* _root, int _rows, int _cols)
+			: root(_root), cols(_cols), distmap(static_cast<size_t>(_rows) * _cols, -1)
 		{
-			distmap[root] = 0;
+			at(root) = 0;
 		}
+
+		bool contains(const cell* _cell) const { return distmap[_cell->row * cols + _cell->col] >= 0; }
+		int& at(const cell* _cell) { return distmap[_cell->row * cols + _cell->col]; }
+		int at(const cell* _cell) const { return distmap[_cell->row * cols + _cell->col]; }
 	};
 
 	struct grid_dist : public grid
@@ -168,8 +173,8 @@ namespace cckit
 
 		virtual std::string cell_str(cell* _cell) const 
 		{ 
-			if (dists && dists->distmap.count(_cell)) {
-				int dist = dists->distmap[_cell];
+			if (dists && dists->contains(_cell)) {
+				int dist = dists->at(_cell);
 				char* dist_str = 0;
 				
 				if (dist >= 0 && dist < 10) {
@@ -184,43 +189,41 @@ namespace cckit
 			return std::string("   ");
 		}
 
+		// expands one whole frontier per distance, so every cell is looked up once in a flat array
 		void update_dists(cell* _cell)
 		{
 			if (dists) delete dists;
-			dists = new distances(_cell);
-
-			queue<cell*> queue;
-			queue.push(_cell);
-			cell* current;
-
-			while (!queue.empty()) {
-				current = queue.front();
-				queue.pop();
-				
-				for (auto iter = current->neighbors.begin();
-					iter != current->neighbors.end(); ++iter) {
-					if (!dists->distmap.count(*iter)
-						&& current->linked(*iter)) {
-						dists->distmap[*iter] = dists->distmap[current] + 1;
-						queue.push(*iter);
+			dists = new distances(_cell, rows, cols);
+
+			std::vector<cell*> frontier(1, _cell), next;
+			for (int dist = 1; !frontier.empty(); ++dist, frontier.swap(next)) {
+				next.clear();
+				for (auto current = frontier.begin(); current != frontier.end(); ++current) {
+					for (auto iter = (*current)->neighbors.begin();
+						iter != (*current)->neighbors.end(); ++iter) {
+						if (!dists->contains(*iter) && (*current)->linked(*iter)) {
+							dists->at(*iter) = dist;
+							next.push_back(*iter);
+						}
 					}
-				}	
+				}
 			}
 		}
 
+		// walks from _goal down the distances, one step per path cell
 		void calc_path(cell* _goal)
 		{
 			if (dists) {
-				if (!dists->distmap.count(_goal)) return;
+				if (!dists->contains(_goal)) return;
 
 				cell* current = _goal;
-				distances* path = new distances(_goal);
-				path->distmap[_goal] = dists->distmap[_goal];
+				distances* path = new distances(_goal, rows, cols);
+				path->at(_goal) = dists->at(_goal);
 				while (current != dists->root) {
 					for (auto iter = current->links.begin();
 						iter != current->links.end(); ++iter) {
-						if (dists->distmap[*iter] < dists->distmap[current]) {
-							path->distmap[*iter] = dists->distmap[*iter];
+						if (dists->at(*iter) == dists->at(current) - 1) {
+							path->at(*iter) = dists->at(*iter);
 							current = *iter;
 							break;
 						}
@@ -339,6 +342,229 @@ namespace cckit
 		}
 	}
 
+	/*
+	A maze grid that stores nothing but its walls: two bits per cell, one for the wall to its east and one for the wall
+	to its south, packed 32 cells to a 64-bit word. The west and north walls of a cell are the east and south walls of its
+	neighbors and the outer boundary is implied, so a 10k x 10k maze takes 25 MB instead of a heap cell with a std::set
+	per position. Cells are addressed by index(row, col) = row * cols + col.
+	*/
+	struct compact_grid
+	{
+		int rows, cols;
+
+		compact_grid(int _rows = 4, int _cols = 4)
+			: rows(_rows), cols(_cols), walls((static_cast<size_t>(_rows) * _cols * 2 + 63) / 64, ~0ull)
+		{}
+
+		size_t index(int _row, int _col) const { return static_cast<size_t>(_row) * cols + _col; }
+		size_t size() const { return static_cast<size_t>(rows) * cols; }
+
+		bool east_wall(size_t _cell) const { return wall(2 * _cell); }
+		bool south_wall(size_t _cell) const { return wall(2 * _cell + 1); }
+
+		// _cell0 and _cell1 have to be horizontally or vertically adjacent; in a single column, cells one apart are vertical
+		bool linked(size_t _cell0, size_t _cell1) const
+		{
+			if (_cell0 > _cell1) std::swap(_cell0, _cell1);
+			return (_cell1 - _cell0 == static_cast<size_t>(cols)) ? !south_wall(_cell0) : !east_wall(_cell0);
+		}
+		void link(size_t _cell0, size_t _cell1)
+		{
+			if (_cell0 > _cell1) std::swap(_cell0, _cell1);
+			clear_wall((_cell1 - _cell0 == static_cast<size_t>(cols)) ? 2 * _cell0 + 1 : 2 * _cell0);
+		}
+
+	private:
+		bool wall(size_t _bit) const { return (walls[_bit >> 6] >> (_bit & 63)) & 1; }
+		void clear_wall(size_t _bit) { walls[_bit >> 6] &= ~(1ull << (_bit & 63)); }
+
+		std::vector<uint64_t> walls;
+	};
+
+	std::ostream& operator <<(std::ostream& _os, const compact_grid& _grid)
+	{
+		_os << "+";
+		for (int i = 0; i < _grid.cols; ++i) { _os << "---+"; }
+		_os << endl;
+
+		for (int i = 0; i < _grid.rows; ++i) {
+			std::string top = "|", bottom = "+";
+			for (int j = 0; j < _grid.cols; ++j) {
+				size_t c = _grid.index(i, j);
+				top += "   ";
+				top += (j + 1 < _grid.cols && !_grid.east_wall(c)) ? " " : "|";
+				bottom += (i + 1 < _grid.rows && !_grid.south_wall(c)) ? "   " : "---";
+				bottom += "+";
+			}
+			_os << top << endl << bottom << endl;
+		}
+
+		return _os;
+	}
+
+	namespace
+	{
+		// one bit per cell, set once a generator has carved into it
+		struct MazeVisitedSet
+		{
+			explicit MazeVisitedSet(size_t _size) : bits((_size + 63) / 64, 0) {}
+			bool test(size_t _cell) const { return (bits[_cell >> 6] >> (_cell & 63)) & 1; }
+			void set(size_t _cell) { bits[_cell >> 6] |= 1ull << (_cell & 63); }
+
+			std::vector<uint64_t> bits;
+		};
+
+		// collects the neighbors of _cell whose visited state equals _visited; returns their number
+		inline int MazeNeighbors(const compact_grid& _grid, const MazeVisitedSet& _set, size_t _cell, bool _visited
+			, size_t _neighbors[4])
+		{
+			int count = 0;
+			size_t row = _cell / _grid.cols, col = _cell - row * _grid.cols;
+			if (col + 1 < static_cast<size_t>(_grid.cols) && _set.test(_cell + 1) == _visited) _neighbors[count++] = _cell + 1;
+			if (row + 1 < static_cast<size_t>(_grid.rows) && _set.test(_cell + _grid.cols) == _visited) _neighbors[count++] = _cell + _grid.cols;
+			if (col > 0 && _set.test(_cell - 1) == _visited) _neighbors[count++] = _cell - 1;
+			if (row > 0 && _set.test(_cell - _grid.cols) == _visited) _neighbors[count++] = _cell - _grid.cols;
+			return count;
+		}
+	}
+
+	void bintree_mazegen(compact_grid& _grid, xorshift_random& _random)
+	{
+		for (int i = 0; i < _grid.rows; ++i)
+			for (int j = 0; j < _grid.cols; ++j) {
+				size_t c = _grid.index(i, j);
+				bool east = j + 1 < _grid.cols, south = i + 1 < _grid.rows;
+				if (east && south) {
+					if (_random() & 1) east = false;
+					else south = false;
+				}
+				if (east) _grid.link(c, c + 1);
+				else if (south) _grid.link(c, c + _grid.cols);
+			}
+	}
+
+	// the stack holds 32-bit cell indices, so a megapixel maze neither recurses nor allocates per cell
+	void rec_backtrack_mazegen(compact_grid& _grid, xorshift_random& _random)
+	{
+		if (_grid.size() == 0) return;
+		assert((_grid.size() <= 0xffffffffull));
+		MazeVisitedSet visited(_grid.size());
+		std::vector<uint32_t> stack;
+
+		size_t start = _grid.index(_random.rand_int(0, _grid.rows), _random.rand_int(0, _grid.cols));
+		visited.set(start);
+		stack.push_back(static_cast<uint32_t>(start));
+		do {
+			size_t current = stack.back();
+			size_t unvisited_neighbors[4];
+			int count = MazeNeighbors(_grid, visited, current, false, unvisited_neighbors);
+
+			if (count == 0)
+				stack.pop_back();
+			else {
+				size_t unvisited_neighbor = unvisited_neighbors[_random.rand_int(0, count)];
+				_grid.link(current, unvisited_neighbor);
+				visited.set(unvisited_neighbor);
+				stack.push_back(static_cast<uint32_t>(unvisited_neighbor));
+			}
+		} while (!stack.empty());
+	}
+
+	// the hunt resumes at the first cell that is not yet visited instead of rescanning the grid from the top
+	void huntnkill_mazegen(compact_grid& _grid, xorshift_random& _random)
+	{
+		if (_grid.size() == 0) return;
+		MazeVisitedSet visited(_grid.size());
+		size_t hunt = 0;
+
+		size_t current = _grid.index(_random.rand_int(0, _grid.rows), _random.rand_int(0, _grid.cols));
+		visited.set(current);
+		for (;;) {
+			size_t neighbors[4];
+			int count = MazeNeighbors(_grid, visited, current, false, neighbors);
+
+			if (count != 0) {
+				size_t unvisited_neighbor = neighbors[_random.rand_int(0, count)];
+				_grid.link(current, unvisited_neighbor);
+				visited.set(unvisited_neighbor);
+				current = unvisited_neighbor;
+				continue;
+			}
+
+			for (; hunt < _grid.size() && visited.test(hunt); ++hunt) {}
+			size_t c = hunt;
+			for (; c < _grid.size(); ++c) {
+				if (visited.test(c)) continue;
+				count = MazeNeighbors(_grid, visited, c, true, neighbors);
+				if (count != 0) break;
+			}
+			if (c == _grid.size()) return;
+
+			_grid.link(c, neighbors[_random.rand_int(0, count)]);
+			visited.set(c);
+			current = c;
+		}
+	}
+
+	/*
+	A distance field over a compact_grid, meant to be recomputed every frame: the distances and both frontiers keep their
+	storage between updates, so an update allocates nothing once the grid size is settled.
+	*/
+	struct distance_field
+	{
+		std::vector<int> dists;// indexed by compact_grid::index(), -1 where unreached
+
+		distance_field() : dists(), frontier(), next() {}
+
+		void update(const compact_grid& _grid, size_t _root)
+		{
+			dists.assign(_grid.size(), -1);
+			dists[_root] = 0;
+			frontier.assign(1, _root);
+			for (int dist = 1; !frontier.empty(); ++dist, frontier.swap(next)) {
+				next.clear();
+				for (auto current = frontier.begin(); current != frontier.end(); ++current) {
+					// the walls along the border are never cleared, so only the first row and cell need a bounds check
+					size_t c = *current;
+					if (!_grid.east_wall(c)) Reach(c + 1, dist);
+					if (!_grid.south_wall(c)) Reach(c + _grid.cols, dist);
+					if (c > 0 && !_grid.east_wall(c - 1)) Reach(c - 1, dist);
+					if (c >= static_cast<size_t>(_grid.cols) && !_grid.south_wall(c - _grid.cols)) Reach(c - _grid.cols, dist);
+				}
+			}
+		}
+
+		// writes the cells from _goal back to the root of the last update; returns the advanced _out
+		template<typename OutputIterator>
+		OutputIterator path(const compact_grid& _grid, size_t _goal, OutputIterator _out) const
+		{
+			if (dists[_goal] < 0) return _out;
+			for (size_t c = _goal; ; ++_out) {
+				*_out = c;
+				int dist = dists[c];
+				if (dist == 0) return ++_out;
+				if (!_grid.east_wall(c) && dists[c + 1] == dist - 1) c = c + 1;
+				else if (!_grid.south_wall(c) && dists[c + _grid.cols] == dist - 1) c = c + _grid.cols;
+				else if (c > 0 && !_grid.east_wall(c - 1) && dists[c - 1] == dist - 1) c = c - 1;
+				else c = c - _grid.cols;
+			}
+		}
+
+	private:
+		void Reach(size_t _cell, int _dist)
+		{
+			if (dists[_cell] >= 0) return;
+			dists[_cell] = _dist;
+			next.push_back(_cell);
+		}
+
+		std::vector<size_t> frontier, next;
+	};
+
+	void bintree_mazegen(compact_grid& _grid) { xorshift_random random; bintree_mazegen(_grid, random); }
+	void rec_backtrack_mazegen(compact_grid& _grid) { xorshift_random random; rec_backtrack_mazegen(_grid, random); }
+	void huntnkill_mazegen(compact_grid& _grid) { xorshift_random random; huntnkill_mazegen(_grid, random); }
+
 	template<typename T>
 	auto sample(const std::vector<T>& _vector)
 		-> decltype(_vector[-1])
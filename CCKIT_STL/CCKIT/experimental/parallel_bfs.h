@@ -0,0 +1,146 @@
+#ifndef CCKIT_PARALLEL_BFS_H
+#define CCKIT_PARALLEL_BFS_H
+
+#include "../internal/config.h"
+#include "../internal/bit_scan.h"
+#include "../thread_pool.h"
+#include "graph.h"
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+namespace cckit
+{
+	/*
+	Direction-optimizing breadth first search over a csr_graph, run level by level on a thread_pool. Frontiers and the
+	visited set are bitmaps with one bit per vertex. While the frontier is small, a top-down step expands its out-edges
+	and claims unvisited targets with an atomic bit set. Once the frontier's out-edges outnumber the unvisited vertices'
+	edges by a fair margin, a bottom-up step lets every unvisited vertex look for any parent in the frontier instead and
+	stop at the first one, which skips most edges of the large middle levels.
+
+	"_reverse"
+	The graph with every edge reversed (csr_graph::transposed()), scanned by bottom-up steps. A symmetric graph, like the
+	4-connected grid of a csv_map, can pass itself.
+
+	"_distances", "_predecessors"
+	Resized to vertex_count(); hop distances from _src, or -1, and the parent in the search tree, or -1, per vertex.
+	*/
+	template<typename T>
+	void parallel_bfsearch(const csr_graph<T>& _graph, const csr_graph<T>& _reverse
+		, typename csr_graph<T>::vertex_type _src, thread_pool& _pool
+		, std::vector<int>& _distances, std::vector<typename csr_graph<T>::vertex_type>& _predecessors);
+}
+
+namespace cckit
+{
+	namespace
+	{
+		// the switching thresholds of Beamer et al., "Direction-Optimizing Breadth-First Search"
+		const size_t BFS_TOP_DOWN_ALPHA = 14;
+		const size_t BFS_BOTTOM_UP_BETA = 24;
+		const size_t BFS_GRAIN_WORDS = 64;// bitmap words per chunk, i.e. 4096 vertices
+
+		inline bool TestBit(const std::vector<std::atomic<uint64_t> >& _bits, size_t _index)
+		{
+			return (_bits[_index >> 6].load(std::memory_order_relaxed) >> (_index & 63)) & 1;
+		}
+	}
+
+	template<typename T>
+	void parallel_bfsearch(const csr_graph<T>& _graph, const csr_graph<T>& _reverse
+		, typename csr_graph<T>::vertex_type _src, thread_pool& _pool
+		, std::vector<int>& _distances, std::vector<typename csr_graph<T>::vertex_type>& _predecessors)
+	{
+		typedef typename csr_graph<T>::vertex_type vertex_type;
+		typedef std::vector<std::atomic<uint64_t> > bitmap_type;
+
+		size_t vertexCount = _graph.vertex_count();
+		assert((_reverse.vertex_count() == vertexCount && _src < vertexCount));
+		size_t wordCount = (vertexCount + 63) >> 6;
+		_distances.assign(vertexCount, -1);
+		_predecessors.assign(vertexCount, static_cast<vertex_type>(-1));
+
+		bitmap_type visited(wordCount), frontier(wordCount), next(wordCount);// value-initialized to zero
+		visited[_src >> 6].store(1ull << (_src & 63));
+		frontier[_src >> 6].store(1ull << (_src & 63));
+		_distances[_src] = 0;
+
+		size_t frontierVertices = 1;
+		size_t frontierEdges = _graph.degree(_src);
+		size_t unvisitedEdges = _graph.edge_count() - frontierEdges;
+		bool bottomUp = false;
+
+		for (int level = 0; frontierVertices > 0; ++level) {
+			bottomUp = bottomUp
+				? frontierVertices * BFS_BOTTOM_UP_BETA >= vertexCount
+				: frontierEdges * BFS_TOP_DOWN_ALPHA > unvisitedEdges;
+
+			std::atomic<size_t> nextVertices(0), nextEdges(0);
+			if (bottomUp) {
+				// every chunk owns its bitmap words, so visited and next are only read-modify-written by one thread
+				_pool.parallel_for(0, wordCount, BFS_GRAIN_WORDS, [&](size_t _first, size_t _last) {
+					size_t foundVertices = 0, foundEdges = 0;
+					for (size_t word = _first; word < _last; ++word) {
+						uint64_t visitedWord = visited[word].load(std::memory_order_relaxed);
+						uint64_t found = 0;
+						for (uint64_t open = ~visitedWord; open; open &= open - 1) {
+							size_t vertex = (word << 6) + lowest_bit_index(open);
+							if (vertex >= vertexCount) break;
+							for (size_t edge = _reverse.edge_begin(static_cast<vertex_type>(vertex))
+								, end = _reverse.edge_end(static_cast<vertex_type>(vertex)); edge != end; ++edge) {
+								vertex_type parent = _reverse.target(edge);
+								if (TestBit(frontier, parent)) {
+									_distances[vertex] = level + 1;
+									_predecessors[vertex] = parent;
+									found |= open & (0 - open);
+									++foundVertices;
+									foundEdges += _graph.degree(static_cast<vertex_type>(vertex));
+									break;
+								}
+							}
+						}
+						visited[word].store(visitedWord | found, std::memory_order_relaxed);
+						next[word].store(found, std::memory_order_relaxed);
+					}
+					nextVertices += foundVertices;
+					nextEdges += foundEdges;
+				});
+			}
+			else {
+				// a target is claimed by whichever thread sets its visited bit first, and only that thread writes its entries
+				_pool.parallel_for(0, wordCount, BFS_GRAIN_WORDS, [&](size_t _first, size_t _last) {
+					size_t foundVertices = 0, foundEdges = 0;
+					for (size_t word = _first; word < _last; ++word) {
+						for (uint64_t bits = frontier[word].load(std::memory_order_relaxed); bits; bits &= bits - 1) {
+							vertex_type vertex = static_cast<vertex_type>((word << 6) + lowest_bit_index(bits));
+							for (size_t edge = _graph.edge_begin(vertex), end = _graph.edge_end(vertex); edge != end; ++edge) {
+								vertex_type adjacent = _graph.target(edge);
+								uint64_t bit = 1ull << (adjacent & 63);
+								if (visited[adjacent >> 6].load(std::memory_order_relaxed) & bit) continue;
+								if (visited[adjacent >> 6].fetch_or(bit, std::memory_order_relaxed) & bit) continue;
+								_distances[adjacent] = level + 1;
+								_predecessors[adjacent] = vertex;
+								next[adjacent >> 6].fetch_or(bit, std::memory_order_relaxed);
+								++foundVertices;
+								foundEdges += _graph.degree(adjacent);
+							}
+						}
+					}
+					nextVertices += foundVertices;
+					nextEdges += foundEdges;
+				});
+			}
+
+			frontier.swap(next);
+			_pool.parallel_for(0, wordCount, BFS_GRAIN_WORDS, [&](size_t _first, size_t _last) {
+				for (size_t word = _first; word < _last; ++word)
+					next[word].store(0, std::memory_order_relaxed);
+			});
+			frontierVertices = nextVertices.load();
+			frontierEdges = nextEdges.load();
+			unvisitedEdges -= frontierEdges;
+		}
+	}
+}
+
+#endif // !CCKIT_PARALLEL_BFS_H
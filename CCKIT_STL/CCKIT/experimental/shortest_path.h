@@ -0,0 +1,264 @@
+#ifndef CCKIT_SHORTEST_PATH_H
+#define CCKIT_SHORTEST_PATH_H
+
+#include "../internal/config.h"
+#include "../priority_queue.h"
+#include "graph.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace cckit
+{
+	// a heap entry packs a 32-bit priority above a 32-bit vertex id, and only the priority takes part in the ordering
+	struct ShortestPathEntryGreater
+	{
+		bool operator()(unsigned long long _lhs, unsigned long long _rhs) const { return (_lhs >> 32) > (_rhs >> 32); }
+	};
+	// radix_heap buckets by the priority alone, so entries of equal priority never look like a non-monotone push
+	template<>
+	struct RadixHeapKey<unsigned long long, ShortestPathEntryGreater>
+	{
+		static unsigned long long Get(unsigned long long _val) { return _val >> 32; }
+	};
+
+	/*
+	Weighted shortest path queries over a csr_graph: Dijkstra, A* and bidirectional Dijkstra. Edge weights have to be
+	non-negative. The distance, predecessor and settled arrays are allocated once per search object and stamped with the
+	number of the query that wrote them, so a query neither reallocates nor clears them and only pays for the vertices it
+	touches. One object serves one query at a time; concurrent queries on the same graph each need their own.
+
+	"DataStructure"
+	The heap behind the open set: radix_heap (default), which is fastest for integral weights, or any of the dary_heap
+	aliases, e.g. quaternary_heap.
+	*/
+	template<typename T, template<typename, typename, typename> class DataStructure = cckit::radix_heap>
+	class shortest_path_search
+	{
+		typedef shortest_path_search<T, DataStructure> this_type;
+	public:
+		typedef csr_graph<T> graph_type;
+		typedef typename graph_type::vertex_type vertex_type;
+		typedef typename graph_type::weight_type weight_type;
+		typedef size_t size_type;
+
+		static const vertex_type NPOS = static_cast<vertex_type>(-1);
+		static const weight_type UNREACHABLE = 0x7fffffff;
+
+	private:
+		typedef unsigned long long entry_type;
+		typedef DataStructure<entry_type, cckit::vector<entry_type>, ShortestPathEntryGreater> heap_type;
+
+		// the per-vertex state of one search direction
+		struct Scratch
+		{
+			std::vector<uint32_t> mStamps;// mDistances and mPredecessors are valid where this equals the query number
+			std::vector<uint32_t> mSettled;
+			std::vector<weight_type> mDistances;
+			std::vector<vertex_type> mPredecessors;
+			heap_type mHeap;
+		};
+
+	public:
+		explicit shortest_path_search(const graph_type& _graph);
+
+		// distance from _src to _dst, or UNREACHABLE; with _dst == NPOS every reachable vertex is settled
+		weight_type dijkstra(vertex_type _src, vertex_type _dst = NPOS);
+		// _heuristic(v) has to be a consistent lower bound of the distance from v to _dst, e.g. the manhattan distance
+		// on a 4-connected grid with unit weights
+		template<typename Heuristic>
+		weight_type astar(vertex_type _src, vertex_type _dst, Heuristic _heuristic);
+		weight_type bidirectional_dijkstra(vertex_type _src, vertex_type _dst);
+
+		// results of the last dijkstra() or astar() query
+		bool reached(vertex_type _vertex) const { return mForward.mStamps[_vertex] == mQuery; }
+		weight_type distance(vertex_type _vertex) const { return reached(_vertex) ? mForward.mDistances[_vertex] : UNREACHABLE; }
+		vertex_type predecessor(vertex_type _vertex) const { return reached(_vertex) ? mForward.mPredecessors[_vertex] : NPOS; }
+
+		// writes the vertices of the last point-to-point query's path from source to target; returns the advanced _out
+		template<typename OutputIterator>
+		OutputIterator path(OutputIterator _out) const;
+
+	private:
+		void BeginQuery();
+		void Reset(Scratch& _scratch);
+		bool Relax(Scratch& _scratch, vertex_type _vertex, vertex_type _predecessor, weight_type _distance);
+		static entry_type Entry(weight_type _priority, vertex_type _vertex) {
+			return (static_cast<entry_type>(_priority) << 32) | _vertex;
+		}
+		static vertex_type EntryVertex(entry_type _entry) { return static_cast<vertex_type>(_entry); }
+		static weight_type EntryPriority(entry_type _entry) { return static_cast<weight_type>(_entry >> 32); }
+
+	private:
+		const graph_type* mpGraph;
+		std::unique_ptr<graph_type> mpReverse;// built on the first bidirectional query
+		Scratch mForward;
+		Scratch mBackward;
+		uint32_t mQuery;
+		vertex_type mTarget;
+		vertex_type mMeeting;// where the two searches of the last bidirectional query joined, NPOS otherwise
+	};
+}
+
+namespace cckit
+{
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	const typename shortest_path_search<T, DataStructure>::vertex_type shortest_path_search<T, DataStructure>::NPOS;
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	const typename shortest_path_search<T, DataStructure>::weight_type shortest_path_search<T, DataStructure>::UNREACHABLE;
+
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	inline shortest_path_search<T, DataStructure>::shortest_path_search(const graph_type& _graph)
+		: mpGraph(&_graph), mpReverse(), mForward(), mBackward(), mQuery(0), mTarget(NPOS), mMeeting(NPOS)
+	{
+		Reset(mForward);
+	}
+
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	typename shortest_path_search<T, DataStructure>::weight_type
+		shortest_path_search<T, DataStructure>::dijkstra(vertex_type _src, vertex_type _dst)
+	{
+		return astar(_src, _dst, [](vertex_type) { return weight_type(0); });
+	}
+
+	// lazy deletion: a vertex whose distance improves is pushed again and the outdated entries are skipped once settled
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	template<typename Heuristic>
+	typename shortest_path_search<T, DataStructure>::weight_type
+		shortest_path_search<T, DataStructure>::astar(vertex_type _src, vertex_type _dst, Heuristic _heuristic)
+	{
+		BeginQuery();
+		mTarget = _dst;
+		const graph_type& graph = *mpGraph;
+		Scratch& scratch = mForward;
+
+		Relax(scratch, _src, NPOS, 0);
+		scratch.mHeap.push(Entry(_heuristic(_src), _src));
+		while (!scratch.mHeap.empty()) {
+			vertex_type vertex = EntryVertex(scratch.mHeap.top());
+			scratch.mHeap.pop();
+			if (scratch.mSettled[vertex] == mQuery) continue;
+			scratch.mSettled[vertex] = mQuery;
+			if (vertex == _dst) break;
+
+			weight_type distance = scratch.mDistances[vertex];
+			for (size_type edge = graph.edge_begin(vertex), end = graph.edge_end(vertex); edge != end; ++edge) {
+				vertex_type adjacent = graph.target(edge);
+				assert((graph.weight(edge) >= 0));
+				weight_type adjacentDistance = distance + graph.weight(edge);
+				if (scratch.mSettled[adjacent] != mQuery && Relax(scratch, adjacent, vertex, adjacentDistance))
+					scratch.mHeap.push(Entry(adjacentDistance + _heuristic(adjacent), adjacent));
+			}
+		}
+		return _dst == NPOS ? 0 : distance(_dst);
+	}
+
+	// alternates between a forward search on the graph and a backward one on its transpose, always advancing the side
+	// with the smaller open priority; the best meeting seen so far is final once the two open minima add up to it.
+	// A meeting is recorded whenever either side lowers a distance the other side already knows, so the recorded vertex
+	// always carries the distances and predecessors that make up the best sum.
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	typename shortest_path_search<T, DataStructure>::weight_type
+		shortest_path_search<T, DataStructure>::bidirectional_dijkstra(vertex_type _src, vertex_type _dst)
+	{
+		if (!mpReverse) {
+			mpReverse.reset(new graph_type(mpGraph->transposed()));
+			Reset(mBackward);
+		}
+		BeginQuery();
+		mTarget = _dst;
+
+		Relax(mForward, _src, NPOS, 0);
+		Relax(mBackward, _dst, NPOS, 0);
+		mForward.mHeap.push(Entry(0, _src));
+		mBackward.mHeap.push(Entry(0, _dst));
+		weight_type best = (_src == _dst) ? 0 : UNREACHABLE;
+		mMeeting = (_src == _dst) ? _src : NPOS;
+
+		while (!mForward.mHeap.empty() && !mBackward.mHeap.empty()) {
+			weight_type forwardMin = EntryPriority(mForward.mHeap.top());
+			weight_type backwardMin = EntryPriority(mBackward.mHeap.top());
+			if (best != UNREACHABLE && forwardMin + backwardMin >= best) break;
+
+			bool forward = forwardMin <= backwardMin;
+			Scratch& scratch = forward ? mForward : mBackward;
+			const Scratch& other = forward ? mBackward : mForward;
+			const graph_type& graph = forward ? *mpGraph : *mpReverse;
+
+			vertex_type vertex = EntryVertex(scratch.mHeap.top());
+			scratch.mHeap.pop();
+			if (scratch.mSettled[vertex] == mQuery) continue;
+			scratch.mSettled[vertex] = mQuery;
+
+			weight_type distance = scratch.mDistances[vertex];
+			for (size_type edge = graph.edge_begin(vertex), end = graph.edge_end(vertex); edge != end; ++edge) {
+				vertex_type adjacent = graph.target(edge);
+				assert((graph.weight(edge) >= 0));
+				weight_type adjacentDistance = distance + graph.weight(edge);
+				if (scratch.mSettled[adjacent] != mQuery && Relax(scratch, adjacent, vertex, adjacentDistance))
+					scratch.mHeap.push(Entry(adjacentDistance, adjacent));
+				if (other.mStamps[adjacent] == mQuery && adjacentDistance + other.mDistances[adjacent] < best) {
+					best = adjacentDistance + other.mDistances[adjacent];
+					mMeeting = adjacent;
+				}
+			}
+		}
+		return best;
+	}
+
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	template<typename OutputIterator>
+	OutputIterator shortest_path_search<T, DataStructure>::path(OutputIterator _out) const
+	{
+		vertex_type meeting = (mMeeting != NPOS) ? mMeeting : mTarget;
+		if (meeting == NPOS || mForward.mStamps[meeting] != mQuery) return _out;
+
+		std::vector<vertex_type> vertices;
+		for (vertex_type vertex = meeting; vertex != NPOS; vertex = mForward.mPredecessors[vertex])
+			vertices.push_back(vertex);
+		for (auto current = vertices.rbegin(), end = vertices.rend(); current != end; ++current, ++_out)
+			*_out = *current;
+		if (mMeeting != NPOS)
+			for (vertex_type vertex = mBackward.mPredecessors[mMeeting]; vertex != NPOS; vertex = mBackward.mPredecessors[vertex], ++_out)
+				*_out = vertex;
+		return _out;
+	}
+
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	inline void shortest_path_search<T, DataStructure>::BeginQuery()
+	{
+		// on wrap around a stale stamp could collide with the new query number, so start over from zeroed arrays
+		if (++mQuery == 0) {
+			Reset(mForward);
+			if (mpReverse) Reset(mBackward);
+			mQuery = 1;
+		}
+		mForward.mHeap.clear();
+		mBackward.mHeap.clear();
+		mMeeting = NPOS;
+	}
+
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	inline void shortest_path_search<T, DataStructure>::Reset(Scratch& _scratch)
+	{
+		size_type vertexCount = mpGraph->vertex_count();
+		_scratch.mStamps.assign(vertexCount, 0);
+		_scratch.mSettled.assign(vertexCount, 0);
+		_scratch.mDistances.resize(vertexCount);
+		_scratch.mPredecessors.resize(vertexCount);
+	}
+
+	// records _distance if it improves on what this query has seen for _vertex
+	template<typename T, template<typename, typename, typename> class DataStructure>
+	inline bool shortest_path_search<T, DataStructure>::Relax(Scratch& _scratch, vertex_type _vertex, vertex_type _predecessor, weight_type _distance)
+	{
+		if (_scratch.mStamps[_vertex] == mQuery && _scratch.mDistances[_vertex] <= _distance)
+			return false;
+		_scratch.mStamps[_vertex] = mQuery;
+		_scratch.mDistances[_vertex] = _distance;
+		_scratch.mPredecessors[_vertex] = _predecessor;
+		return true;
+	}
+}
+
+#endif // !CCKIT_SHORTEST_PATH_H
@@ -3,144 +3,318 @@
 
 #include "internal/config.h"
 #include "utility.h"
+#include "type_traits.h"
+#ifdef CCKIT_SSE2
+#include <emmintrin.h>
+#endif // CCKIT_SSE2
 
 namespace cckit
 {
 	namespace
 	{
-		inline int Parent(int _pos) { return (_pos - 1) >> 1; }
-		inline int Left(int _pos) { return (_pos << 1) + 1; }
-		inline int Right(int _pos) { return (_pos << 1) + 2; }
+		// positions are size_t so that heaps beyond 2^31 elements stay addressable
+		template<size_t Arity> inline size_t Parent(size_t _pos) { return (_pos - 1) / Arity; }
+		template<size_t Arity> inline size_t FirstChild(size_t _pos) { return _pos * Arity + 1; }
 
-		template<typename RandomAccessIterator, typename StrictWeakOrdering>
-		void PromoteHeap(RandomAccessIterator _first, int _pos, StrictWeakOrdering _compare)
+		template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+		size_t ScanHeapChildren(RandomAccessIterator _first, size_t _child, size_t _heapSize, StrictWeakOrdering _compare)
 		{
-			for (decltype(_pos) parentPos = cckit::Parent(_pos);
+			size_t largest = _child, last = _child + Arity;
+			if (last > _heapSize)
+				last = _heapSize;
+			for (++_child; _child < last; ++_child)
+				if (_compare(*(_first + largest), *(_first + _child)))
+					largest = _child;
+			return largest;
+		}
+
+		// returns the position of the child that has to be promoted, i.e. the leftmost one no sibling is ordered after
+		template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering, typename = void>
+		struct HeapChildSelector
+		{
+			static size_t Select(RandomAccessIterator _first, size_t _child, size_t _heapSize, StrictWeakOrdering _compare) {
+				return cckit::ScanHeapChildren<Arity>(_first, _child, _heapSize, _compare);
+			}
+		};
+
+#ifdef CCKIT_SSE2
+		template<typename Key>
+		struct IsHeapSimdKey : public integral_constant<bool, is_same<Key, int>::value || is_same<Key, float>::value> {};
+
+		// reduces a full group of Arity children 4 lanes at a time; Max selects the largest key, otherwise the smallest
+		template<bool Max>
+		struct HeapSimdKernel
+		{
+			static __m128 Load(const float* _keys) { return _mm_loadu_ps(_keys); }
+			static __m128i Load(const int* _keys) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(_keys)); }
+
+			static __m128 Pick(__m128 _a, __m128 _b) { return Max ? _mm_max_ps(_a, _b) : _mm_min_ps(_a, _b); }
+			static __m128i Pick(__m128i _a, __m128i _b) {
+				__m128i mask = Max ? _mm_cmpgt_epi32(_a, _b) : _mm_cmplt_epi32(_a, _b);
+				return _mm_or_si128(_mm_and_si128(mask, _a), _mm_andnot_si128(mask, _b));
+			}
+
+			static __m128 SwapPairs(__m128 _v) { return _mm_shuffle_ps(_v, _v, _MM_SHUFFLE(2, 3, 0, 1)); }
+			static __m128i SwapPairs(__m128i _v) { return _mm_shuffle_epi32(_v, _MM_SHUFFLE(2, 3, 0, 1)); }
+			static __m128 SwapHalves(__m128 _v) { return _mm_shuffle_ps(_v, _v, _MM_SHUFFLE(1, 0, 3, 2)); }
+			static __m128i SwapHalves(__m128i _v) { return _mm_shuffle_epi32(_v, _MM_SHUFFLE(1, 0, 3, 2)); }
+
+			static int EqualMask(__m128 _a, __m128 _b) { return _mm_movemask_ps(_mm_cmpeq_ps(_a, _b)); }
+			static int EqualMask(__m128i _a, __m128i _b) { return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_a, _b))); }
+
+			template<size_t Arity, typename Key>
+			static size_t Select(const Key* _keys) {
+				auto extreme = Load(_keys);
+				for (size_t i = 4; i < Arity; i += 4)
+					extreme = Pick(extreme, Load(_keys + i));
+				extreme = Pick(extreme, SwapPairs(extreme));
+				extreme = Pick(extreme, SwapHalves(extreme));
+
+				size_t i = 0;
+				int mask = 0;
+				for (; (mask = EqualMask(Load(_keys + i), extreme)) == 0; i += 4) {}
+				for (; (mask & 1) == 0; mask >>= 1, ++i) {}
+				return i;
+			}
+		};
+
+		template<size_t Arity, typename Key, bool Max>
+		struct HeapSimdChildSelector
+		{
+			template<typename StrictWeakOrdering>
+			static size_t Select(Key* _first, size_t _child, size_t _heapSize, StrictWeakOrdering _compare) {
+				if (_child + Arity <= _heapSize)
+					return _child + HeapSimdKernel<Max>::template Select<Arity>(_first + _child);
+				return cckit::ScanHeapChildren<Arity>(_first, _child, _heapSize, _compare);
+			}
+		};
+
+		template<size_t Arity, typename Key>
+		struct HeapChildSelector<Arity, Key*, cckit::less<Key>, enable_if_t<(Arity % 4 == 0) && IsHeapSimdKey<Key>::value> >
+			: public HeapSimdChildSelector<Arity, Key, true> {};
+		template<size_t Arity, typename Key>
+		struct HeapChildSelector<Arity, Key*, cckit::greater<Key>, enable_if_t<(Arity % 4 == 0) && IsHeapSimdKey<Key>::value> >
+			: public HeapSimdChildSelector<Arity, Key, false> {};
+#endif // CCKIT_SSE2
+
+		template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+		void PromoteHeap(RandomAccessIterator _first, size_t _pos, StrictWeakOrdering _compare)
+		{
+			for (size_t parentPos = cckit::Parent<Arity>(_pos);
 				_pos > 0 && _compare(*(_first + parentPos), *(_first + _pos));
-				_pos = parentPos, parentPos = cckit::Parent(_pos))
+				_pos = parentPos, parentPos = cckit::Parent<Arity>(_pos))
 				cckit::swap(*(_first + parentPos), *(_first + _pos));
 		}
 
-		template<typename RandomAccessIterator, typename StrictWeakOrdering>
-		void DemoteHeap(RandomAccessIterator _first, int _heapSize, int _pos, StrictWeakOrdering _compare)
+		template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+		void DemoteHeap(RandomAccessIterator _first, size_t _heapSize, size_t _pos, StrictWeakOrdering _compare)
 		{
-			decltype(_pos) right = cckit::Right(_pos), left = right - 1, largest = _pos;
-			if (left < _heapSize && _compare(*(_first + largest), *(_first + left))) 
-				largest = left;
-			if (right < _heapSize && _compare(*(_first + largest), *(_first + right)))
-				largest = right;
-			if (largest != _pos) {
+			typedef HeapChildSelector<Arity, RandomAccessIterator, StrictWeakOrdering> selector_type;
+			for (size_t child = cckit::FirstChild<Arity>(_pos); child < _heapSize; child = cckit::FirstChild<Arity>(_pos)) {
+				size_t largest = selector_type::Select(_first, child, _heapSize, _compare);
+				if (!_compare(*(_first + _pos), *(_first + largest)))
+					break;
 				cckit::swap(*(_first + _pos), *(_first + largest));
-				DemoteHeap(_first, _heapSize, largest, _compare);
+				_pos = largest;
 			}
 		}
+
+		// orders elements the other way round, so that a heap built with it keeps the least prioritized element on top
+		template<typename StrictWeakOrdering>
+		struct InvertedOrdering
+		{
+			explicit InvertedOrdering(StrictWeakOrdering _compare) : mCompare(_compare) {}
+			template<typename Arg0, typename Arg1>
+			bool operator()(const Arg0& _arg0, const Arg1& _arg1) const { return mCompare(_arg1, _arg0); }
+			StrictWeakOrdering mCompare;
+		};
 	}
 
-	template<typename RandomAccessIterator>
-	inline bool is_heap(RandomAccessIterator _first, RandomAccessIterator _last)
+	/*
+	The heap operations below default to a binary heap. Every operation taking a comparator is also offered with a leading
+	Arity template argument, e.g. cckit::make_heap<4>(first, last, compare), which lays out a d-ary heap whose children of
+	position i are stored contiguously at [Arity * i + 1, Arity * i + Arity]. Wider nodes halve the tree height per doubling
+	of Arity and keep the children scanned by a sift-down within one or two cache lines.
+	*/
+	template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+	RandomAccessIterator is_heap_until(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
 	{
-		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
-		return cckit::is_heap(_first, _last, cckit::less<value_type>());
+		size_t heapSize = _last - _first;
+		for (size_t pos = 1; pos < heapSize; ++pos)
+			if (_compare(*(_first + cckit::Parent<Arity>(pos)), *(_first + pos)))
+				return _first + pos;
+		return _last;
 	}
 	template<typename RandomAccessIterator, typename StrictWeakOrdering>
-	inline bool is_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	inline RandomAccessIterator is_heap_until(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
 	{
-		return cckit::is_heap_until(_first, _last, _compare) == _last;
+		return cckit::is_heap_until<2>(_first, _last, _compare);
 	}
-
 	template<typename RandomAccessIterator>
 	inline RandomAccessIterator is_heap_until(RandomAccessIterator _first, RandomAccessIterator _last)
 	{
 		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
 		return cckit::is_heap_until(_first, _last, cckit::less<value_type>());
 	}
+
+	template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+	inline bool is_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	{
+		return cckit::is_heap_until<Arity>(_first, _last, _compare) == _last;
+	}
 	template<typename RandomAccessIterator, typename StrictWeakOrdering>
-	RandomAccessIterator is_heap_until(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	inline bool is_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
 	{
-		decltype(_first) current = _first;
-		for (; current != _last; ++current) 
-			if (_compare(*(_first + Parent(current - _first)), *current)) 
-				break;
-		return current;
+		return cckit::is_heap<2>(_first, _last, _compare);
+	}
+	template<typename RandomAccessIterator>
+	inline bool is_heap(RandomAccessIterator _first, RandomAccessIterator _last)
+	{
+		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
+		return cckit::is_heap(_first, _last, cckit::less<value_type>());
 	}
 
+	template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+	void make_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	{
+		size_t heapSize = _last - _first;
+		if (heapSize < 2) return;
+		for (size_t i = cckit::Parent<Arity>(heapSize - 1) + 1; i-- > 0;)
+			cckit::DemoteHeap<Arity>(_first, heapSize, i, _compare);
+	}
+	template<typename RandomAccessIterator, typename StrictWeakOrdering>
+	inline void make_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	{
+		cckit::make_heap<2>(_first, _last, _compare);
+	}
 	template<typename RandomAccessIterator>
 	inline void make_heap(RandomAccessIterator _first, RandomAccessIterator _last)
 	{
 		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
 		cckit::make_heap(_first, _last, cckit::less<value_type>());
 	}
+
+	template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+	inline void push_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	{
+		cckit::PromoteHeap<Arity>(_first, _last - _first - 1, _compare);
+	}
 	template<typename RandomAccessIterator, typename StrictWeakOrdering>
-	inline void make_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	inline void push_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
 	{
-		auto heapSize = _last - _first;
-		for (decltype(heapSize) i = cckit::Parent(heapSize - 1); i >= 0; --i)
-			cckit::DemoteHeap(_first, heapSize, i, _compare);
+		cckit::push_heap<2>(_first, _last, _compare);
 	}
-
 	template<typename RandomAccessIterator>
 	inline void push_heap(RandomAccessIterator _first, RandomAccessIterator _last)
 	{
 		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
 		cckit::push_heap(_first, _last, cckit::less<value_type>());
 	}
+
+	template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+	inline void pop_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	{
+		cckit::swap(*_first, *(_last - 1));
+		cckit::DemoteHeap<Arity>(_first, _last - _first - 1, 0, _compare);
+	}
 	template<typename RandomAccessIterator, typename StrictWeakOrdering>
-	inline void push_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	inline void pop_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
 	{
-		cckit::PromoteHeap(_first, _last - _first - 1, _compare);
+		cckit::pop_heap<2>(_first, _last, _compare);
 	}
-
 	template<typename RandomAccessIterator>
 	inline void pop_heap(RandomAccessIterator _first, RandomAccessIterator _last)
 	{
 		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
 		cckit::pop_heap(_first, _last, cckit::less<value_type>());
 	}
+
+	template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+	inline void sort_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	{
+		for (; _last != _first; cckit::pop_heap<Arity>(_first, _last, _compare), --_last) {}
+	}
 	template<typename RandomAccessIterator, typename StrictWeakOrdering>
-	inline void pop_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	inline void sort_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
 	{
-		cckit::swap(*_first, *(_last - 1));
-		cckit::DemoteHeap(_first, _last - _first - 1, 0, _compare);
+		cckit::sort_heap<2>(_first, _last, _compare);
 	}
-
 	template<typename RandomAccessIterator>
 	inline void sort_heap(RandomAccessIterator _first, RandomAccessIterator _last)
 	{
 		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
 		cckit::sort_heap(_first, _last, cckit::less<value_type>());
 	}
+
+	template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+	void remove_heap(RandomAccessIterator _first, RandomAccessIterator _last, RandomAccessIterator _pos, StrictWeakOrdering _compare)
+	{
+		cckit::swap(*_pos, *(_last - 1));
+		size_t posOffset = _pos - _first;
+		cckit::DemoteHeap<Arity>(_first, _last - _first - 1, posOffset, _compare);
+		cckit::PromoteHeap<Arity>(_first, posOffset, _compare);
+	}
 	template<typename RandomAccessIterator, typename StrictWeakOrdering>
-	inline void sort_heap(RandomAccessIterator _first, RandomAccessIterator _last, StrictWeakOrdering _compare)
+	inline void remove_heap(RandomAccessIterator _first, RandomAccessIterator _last, RandomAccessIterator _pos, StrictWeakOrdering _compare)
 	{
-		for (; _last != _first; cckit::pop_heap(_first, _last, _compare), --_last) {}
+		cckit::remove_heap<2>(_first, _last, _pos, _compare);
 	}
-
 	template<typename RandomAccessIterator>
 	inline void remove_heap(RandomAccessIterator _first, RandomAccessIterator _last, RandomAccessIterator _pos)
 	{
 		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
 		cckit::remove_heap(_first, _last, _pos, cckit::less<value_type>());
 	}
+
+	template<size_t Arity, typename RandomAccessIterator, typename StrictWeakOrdering>
+	inline void change_heap(RandomAccessIterator _first, RandomAccessIterator _last, RandomAccessIterator _pos, StrictWeakOrdering _compare)
+	{
+		cckit::remove_heap<Arity>(_first, _last, _pos, _compare);
+		cckit::PromoteHeap<Arity>(_first, _last - _first - 1, _compare);
+	}
 	template<typename RandomAccessIterator, typename StrictWeakOrdering>
-	void remove_heap(RandomAccessIterator _first, RandomAccessIterator _last, RandomAccessIterator _pos, StrictWeakOrdering _compare)
+	inline void change_heap(RandomAccessIterator _first, RandomAccessIterator _last, RandomAccessIterator _pos, StrictWeakOrdering _compare)
 	{
-		cckit::swap(*_pos, *(_last - 1));
-		auto posOffset = _pos - _first;
-		cckit::DemoteHeap(_first, _last - _first - 1, posOffset, _compare);
-		cckit::PromoteHeap(_first, posOffset, _compare);
+		cckit::change_heap<2>(_first, _last, _pos, _compare);
 	}
-
 	template<typename RandomAccessIterator>
 	inline void change_heap(RandomAccessIterator _first, RandomAccessIterator _last, RandomAccessIterator _pos)
 	{
 		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
 		cckit::change_heap(_first, _last, _pos, cckit::less<value_type>());
 	}
-	template<typename RandomAccessIterator, typename StrictWeakOrdering>
-	inline void change_heap(RandomAccessIterator _first, RandomAccessIterator _last, RandomAccessIterator _pos, StrictWeakOrdering _compare)
+
+	/*
+	Rearranges [_first, _last) so that [_first, _first + _count) holds the _count most prioritized elements, the top one
+	first, and returns the end of that prefix. A heap of the best _count candidates seen so far is kept with the worst one
+	on top, so every remaining element costs one comparison unless it displaces that candidate: O(n log k) overall
+	instead of heapifying or sorting all n elements.
+	*/
+	template<typename RandomAccessIterator, typename Size, typename StrictWeakOrdering>
+	RandomAccessIterator top_k(RandomAccessIterator _first, RandomAccessIterator _last, Size _count, StrictWeakOrdering _compare)
 	{
-		cckit::remove_heap(_first, _last, _pos, _compare);
-		cckit::PromoteHeap(_first, _last - _first - 1, _compare);
+		size_t rangeSize = _last - _first, count = static_cast<size_t>(_count);
+		if (count > rangeSize)
+			count = rangeSize;
+		RandomAccessIterator middle = _first + count;
+		if (count == 0) return middle;
+
+		InvertedOrdering<StrictWeakOrdering> inverted(_compare);
+		cckit::make_heap<2>(_first, middle, inverted);
+		for (RandomAccessIterator current = middle; current != _last; ++current) {
+			if (_compare(*_first, *current)) {
+				cckit::swap(*_first, *current);
+				cckit::DemoteHeap<2>(_first, count, 0, inverted);
+			}
+		}
+		cckit::sort_heap<2>(_first, middle, inverted);
+		return middle;
+	}
+	template<typename RandomAccessIterator, typename Size>
+	inline RandomAccessIterator top_k(RandomAccessIterator _first, RandomAccessIterator _last, Size _count)
+	{
+		typedef typename cckit::iterator_traits<RandomAccessIterator>::value_type value_type;
+		return cckit::top_k(_first, _last, _count, cckit::less<value_type>());
 	}
 }
 
@@ -26,13 +26,20 @@ namespace cckit
 
 	"Compare"
 	A Compare type providing a strict weak ordering.
+
+	"Arity"
+	The number of children per node. binary_heap is the Arity = 2 case; 4 or 8 keep a node's children within one cache line
+	and shorten the sift-down path to log4(n) or log8(n) levels, which pays off for large heaps dominated by pop().
 	*/
-	template<typename T, typename Container = cckit::vector<T>, typename Compare = cckit::less<T> >
-	class binary_heap
+	template<typename T, typename Container = cckit::vector<T>, typename Compare = cckit::less<T>, size_t Arity = 2>
+	class dary_heap
 	{
+		static_assert(Arity >= 2, "a heap node needs at least two children");
 	private:
-		typedef binary_heap<T, Container, Compare> this_type;
+		typedef dary_heap<T, Container, Compare, Arity> this_type;
 	public:
+		static const size_t ARITY = Arity;
+
 		typedef Container container_type;
 		typedef Compare value_compare;
 		typedef typename Container::value_type value_type;
@@ -41,60 +48,60 @@ namespace cckit
 		typedef typename Container::const_reference const_reference;
 
 	public:
-		binary_heap(const value_compare& _compare, const container_type& _container)
+		dary_heap(const value_compare& _compare, const container_type& _container)
 			: mCompare(_compare), mContainer(_container) {
-			cckit::make_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::make_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
-		binary_heap(const value_compare& _compare = value_compare(), container_type&& _container = container_type())
+		dary_heap(const value_compare& _compare = value_compare(), container_type&& _container = container_type())
 			: mCompare(_compare), mContainer(cckit::move(_container)) {
-			cckit::make_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::make_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
-		binary_heap(const this_type& _other)
-			: binary_heap(_other.mCompare, _other.mContainer)
+		dary_heap(const this_type& _other)
+			: dary_heap(_other.mCompare, _other.mContainer)
 		{}
-		binary_heap(this_type&& _other)
-			: binary_heap(_other.mCompare, cckit::move(_other.mContainer))
+		dary_heap(this_type&& _other)
+			: dary_heap(_other.mCompare, cckit::move(_other.mContainer))
 		{}
 		template<typename Allocator, enable_if_t<cckit::uses_allocator<Container, Allocator>::value>* = 0>
-		explicit binary_heap(const Allocator& _allocator)
+		explicit dary_heap(const Allocator& _allocator)
 			: mCompare(), mContainer(_allocator) {
-			cckit::make_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::make_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 		template<typename Allocator, enable_if_t<cckit::uses_allocator<Container, Allocator>::value>* = 0>
-		explicit binary_heap(const value_compare& _compare, const Allocator& _allocator)
+		explicit dary_heap(const value_compare& _compare, const Allocator& _allocator)
 			: mCompare(_compare), mContainer(_allocator) {
-			cckit::make_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::make_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 		template<typename Allocator, enable_if_t<cckit::uses_allocator<Container, Allocator>::value>* = 0>
-		explicit binary_heap(const value_compare& _compare, const container_type& _container, const Allocator& _allocator)
+		explicit dary_heap(const value_compare& _compare, const container_type& _container, const Allocator& _allocator)
 			: mCompare(_compare), mContainer(_container, _allocator) {
-			cckit::make_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::make_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 		template<typename Allocator, enable_if_t<cckit::uses_allocator<Container, Allocator>::value>* = 0>
-		explicit binary_heap(const value_compare& _compare, container_type&& _container, const Allocator& _allocator)
+		explicit dary_heap(const value_compare& _compare, container_type&& _container, const Allocator& _allocator)
 			: mCompare(_compare), mContainer(cckit::move(_container), _allocator) {
-			cckit::make_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::make_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 		template<typename Allocator, enable_if_t<cckit::uses_allocator<Container, Allocator>::value>* = 0>
-		binary_heap(const this_type& _other, const Allocator& _allocator)
-			: binary_heap(_other.mCompare, _other.mContainer, _allocator)
+		dary_heap(const this_type& _other, const Allocator& _allocator)
+			: dary_heap(_other.mCompare, _other.mContainer, _allocator)
 		{}
 		template<typename Allocator, enable_if_t<cckit::uses_allocator<Container, Allocator>::value>* = 0>
-		binary_heap(this_type&& _other, const Allocator& _allocator)
-			: binary_heap(_other.mCompare, cckit::move(_other.mContainer), _allocator)
+		dary_heap(this_type&& _other, const Allocator& _allocator)
+			: dary_heap(_other.mCompare, cckit::move(_other.mContainer), _allocator)
 		{}
 		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
-		binary_heap(InputIterator _first, InputIterator _last, const value_compare& _compare, const container_type& _container)
+		dary_heap(InputIterator _first, InputIterator _last, const value_compare& _compare, const container_type& _container)
 			: mCompare(_compare), mContainer(_container) {
 			mContainer.insert(mContainer.cend(), _first, _last);
-			cckit::make_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::make_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
-		binary_heap(InputIterator _first, InputIterator _last
+		dary_heap(InputIterator _first, InputIterator _last
 			, const value_compare& _compare = value_compare(), container_type&& _container = container_type())
 			: mCompare(_compare), mContainer(cckit::move(_container)) {
 			mContainer.insert(mContainer.cend(), _first, _last);
-			cckit::make_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::make_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 
 		this_type& operator=(const this_type& _other) { mContainer = _other.mContainer; return *this; }
@@ -106,24 +113,63 @@ namespace cckit
 
 		void push(const value_type& _val) {
 			mContainer.push_back(_val);
-			cckit::push_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::push_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 		void push(value_type&& _val) {
 			mContainer.push_back(cckit::move(_val));
-			cckit::push_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::push_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 
 		template<typename... Args >
 		void emplace(Args&&... _args) {
 			mContainer.emplace_back(cckit::forward<Args>(_args)...);
-			cckit::push_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::push_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 		}
 
 		void pop() {
-			cckit::pop_heap(mContainer.begin(), mContainer.end(), mCompare);
+			cckit::pop_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare);
 			mContainer.pop_back();
 		}
 
+		void clear() { mContainer.clear(); }
+
+		// appends a batch and restores the heap either by sifting up each new element, which costs about count * depth
+		// comparisons, or by Floyd's bottom-up rebuild of the whole heap, which costs about 2 * size(), whichever is cheaper
+		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
+		void push_range(InputIterator _first, InputIterator _last) {
+			size_type oldSize = mContainer.size();
+			mContainer.insert(mContainer.cend(), _first, _last);
+			size_type newSize = mContainer.size(), count = newSize - oldSize;
+
+			size_type depth = 1;
+			for (size_type rest = newSize / Arity; rest > 0; rest /= Arity, ++depth) {}
+
+			auto first = mContainer.begin();
+			if (count * depth > 2 * newSize)
+				cckit::make_heap<Arity>(first, mContainer.end(), mCompare);
+			else
+				for (size_type i = oldSize + 1; i <= newSize; ++i)
+					cckit::push_heap<Arity>(first, first + i, mCompare);
+		}
+
+		// writes the _count top elements to _out in priority order and removes them; returns the advanced _out
+		template<typename OutputIterator>
+		OutputIterator pop_n(size_type _count, OutputIterator _out) {
+			size_type heapSize = mContainer.size();
+			if (_count > heapSize)
+				_count = heapSize;
+			// each pop_heap parks the current top right behind the shrinking heap, so the extracted elements end up at
+			// the back of the container in reverse priority order and leave it with _count pop_back calls
+			auto first = mContainer.begin();
+			for (size_type i = 0; i < _count; ++i, --heapSize)
+				cckit::pop_heap<Arity>(first, first + heapSize, mCompare);
+			for (size_type i = mContainer.size(); i > heapSize; ++_out)
+				*_out = cckit::move(mContainer[--i]);
+			for (size_type i = 0; i < _count; ++i)
+				mContainer.pop_back();
+			return _out;
+		}
+
 		void swap(this_type& _other) noexcept(noexcept(cckit::swap(mCompare, _other.mCompare)) 
 			&& noexcept(cckit::swap(mContainer, _other.mContainer))) {
 			cckit::swap(mCompare, _other.mCompare);
@@ -131,27 +177,35 @@ namespace cckit
 		}
 
 		void remove(size_type _index) {
-			assert((_index >= 0)); assert((_index < size()));
+			assert((_index < size()));
 			auto first = mContainer.begin();
-			cckit::remove_heap(first, mContainer.end(), first + _index, mCompare);
+			cckit::remove_heap<Arity>(first, mContainer.end(), first + _index, mCompare);
 			mContainer.pop_back();
 		}
 
 		template<typename... Args>
 		void modify(size_type _index, Args... _args) {
-			assert((_index >= 0)); assert((_index < size()));
+			assert((_index < size()));
 			cckit::initialized_init(&mContainer[_index], cckit::forward<Args>(_args)...);
 			auto first = mContainer.begin();
-			cckit::change_heap(first, mContainer.end(), first + _index, mCompare);
+			cckit::change_heap<Arity>(first, mContainer.end(), first + _index, mCompare);
 		}
 
 		const_reference operator[](size_type _index) const { return mContainer[_index]; }
-		bool validate() const { return cckit::is_heap(mContainer.begin(), mContainer.end(), mCompare); }
+		bool validate() const { return cckit::is_heap<Arity>(mContainer.begin(), mContainer.end(), mCompare); }
 
 	protected:
 		container_type mContainer;
 		value_compare mCompare;
 	};
+
+	// alias templates so that the heaps can be plugged into priority_queue's DataStructure parameter
+	template<typename T, typename Container = cckit::vector<T>, typename Compare = cckit::less<T> >
+	using binary_heap = dary_heap<T, Container, Compare, 2>;
+	template<typename T, typename Container = cckit::vector<T>, typename Compare = cckit::less<T> >
+	using quaternary_heap = dary_heap<T, Container, Compare, 4>;
+	template<typename T, typename Container = cckit::vector<T>, typename Compare = cckit::less<T> >
+	using octonary_heap = dary_heap<T, Container, Compare, 8>;
 }
 
 #endif // !CCKIT_BINARY_HEAP_H
\ No newline at end of file
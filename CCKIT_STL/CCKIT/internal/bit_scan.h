@@ -0,0 +1,73 @@
+#ifndef CCKIT_BIT_SCAN_H
+#define CCKIT_BIT_SCAN_H
+
+#include "config.h"
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif // _MSC_VER
+
+namespace cckit
+{
+	// index of the lowest set bit; _word must not be 0
+	inline uint32_t lowest_bit_index(uint32_t _word)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, _word);
+		return index;
+#elif defined(__GNUC__)
+		return __builtin_ctz(_word);
+#else
+		uint32_t index = 0;
+		for (; !(_word & 1); _word >>= 1, ++index) {}
+		return index;
+#endif // _MSC_VER
+	}
+
+	inline uint32_t lowest_bit_index(uint64_t _word)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, _word);
+		return index;
+#elif defined(__GNUC__)
+		return __builtin_ctzll(_word);
+#else
+		uint32_t low = static_cast<uint32_t>(_word);
+		return low ? lowest_bit_index(low) : 32 + lowest_bit_index(static_cast<uint32_t>(_word >> 32));
+#endif // _MSC_VER && _M_X64
+	}
+
+	// the number of leading zero bits; _word must not be 0
+	inline uint32_t leading_zeros(uint32_t _word)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanReverse(&index, _word);
+		return 31 - index;
+#elif defined(__GNUC__)
+		return __builtin_clz(_word);
+#else
+		uint32_t count = 0;
+		for (; !(_word & 0x80000000u); _word <<= 1, ++count) {}
+		return count;
+#endif // _MSC_VER
+	}
+
+	inline uint32_t leading_zeros(uint64_t _word)
+	{
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanReverse64(&index, _word);
+		return 63 - index;
+#elif defined(__GNUC__)
+		return __builtin_clzll(_word);
+#else
+		uint32_t high = static_cast<uint32_t>(_word >> 32);
+		return high ? leading_zeros(high) : 32 + leading_zeros(static_cast<uint32_t>(_word));
+#endif // _MSC_VER && _M_X64
+	}
+}
+
+#endif // !CCKIT_BIT_SCAN_H
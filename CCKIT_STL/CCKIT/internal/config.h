@@ -20,6 +20,20 @@
 #define CCKIT_DEFAULT_ALLOCATOR_TYPE cckit::allocator
 #define CCKIT_ASSERT(expr) assert((expr))
 
+// SIMD kernels are only compiled in when the target guarantees the instruction set
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CCKIT_SSE2 1
+#endif
+#if defined(__AVX__)
+#define CCKIT_AVX 1
+#endif
+#if defined(__AVX2__)
+#define CCKIT_AVX2 1
+#endif
+#if defined(__AVX512F__)
+#define CCKIT_AVX512 1
+#endif
+
 typedef size_t cckit_size_t;
 typedef ptrdiff_t cckit_ptrdiff_t;
 
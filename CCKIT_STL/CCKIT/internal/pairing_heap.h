@@ -0,0 +1,255 @@
+#ifndef CCKIT_PAIRING_HEAP_H
+#define CCKIT_PAIRING_HEAP_H
+
+#include "config.h"
+#include "../vector.h"
+#include "../functional.h"
+#include "../memory.h"
+
+namespace cckit
+{
+	template<typename T>
+	struct PairingHeapNode
+	{
+		template<typename... Args>
+		explicit PairingHeapNode(Args&&... _args)
+			: mpChild(nullptr), mpSibling(nullptr), mVal(cckit::forward<Args>(_args)...)
+		{}
+
+		PairingHeapNode* mpChild;
+		PairingHeapNode* mpSibling;// next child of the same parent, or the next tree of a root list
+		T mVal;
+	};
+
+	/*
+	A pairing heap is a heap-ordered multiway tree. push() and meld() only link two roots and run in constant time, while
+	pop() merges the children of the old root pairwise in two passes, which costs amortized logarithmic time. It can be
+	plugged into priority_queue through its DataStructure parameter:
+		cckit::priority_queue<T, cckit::vector<T>, cckit::greater<T>, cckit::pairing_heap>
+
+	"Container"
+	Only used as the source of initial elements and for the member typedefs; the elements live in individually allocated
+	nodes, so no random access container is required.
+
+	"Compare"
+	A Compare type providing a strict weak ordering. As with binary_heap, the largest element appears as top() by default.
+	*/
+	template<typename T, typename Container = cckit::vector<T>, typename Compare = cckit::less<T> >
+	class pairing_heap
+	{
+	private:
+		typedef pairing_heap<T, Container, Compare> this_type;
+		typedef PairingHeapNode<T> node_type;
+	public:
+		typedef Container container_type;
+		typedef Compare value_compare;
+		typedef typename Container::value_type value_type;
+		typedef typename Container::size_type size_type;
+		typedef typename Container::reference reference;
+		typedef typename Container::const_reference const_reference;
+		typedef CCKIT_DEFAULT_ALLOCATOR_TYPE allocator_type;
+
+	public:
+		pairing_heap(const value_compare& _compare, const container_type& _container)
+			: mpRoot(nullptr), mSize(0), mCompare(_compare), mAllocator() {
+			for (auto current = _container.begin(), end = _container.end(); current != end; ++current)
+				push(*current);
+		}
+		pairing_heap(const value_compare& _compare = value_compare(), container_type&& _container = container_type())
+			: mpRoot(nullptr), mSize(0), mCompare(_compare), mAllocator() {
+			for (auto current = _container.begin(), end = _container.end(); current != end; ++current)
+				push(cckit::move(*current));
+		}
+		pairing_heap(const this_type& _other)
+			: mpRoot(nullptr), mSize(0), mCompare(_other.mCompare), mAllocator() {
+			CopyFrom(_other);
+		}
+		pairing_heap(this_type&& _other)
+			: mpRoot(_other.mpRoot), mSize(_other.mSize), mCompare(_other.mCompare), mAllocator() {
+			_other.mpRoot = nullptr;
+			_other.mSize = 0;
+		}
+		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
+		pairing_heap(InputIterator _first, InputIterator _last, const value_compare& _compare, const container_type& _container)
+			: pairing_heap(_compare, _container) {
+			for (; _first != _last; ++_first)
+				push(*_first);
+		}
+		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
+		pairing_heap(InputIterator _first, InputIterator _last
+			, const value_compare& _compare = value_compare(), container_type&& _container = container_type())
+			: pairing_heap(_compare, cckit::move(_container)) {
+			for (; _first != _last; ++_first)
+				push(*_first);
+		}
+		~pairing_heap() { clear(); }
+
+		this_type& operator=(const this_type& _other) {
+			if (this != &_other) {
+				clear();
+				mCompare = _other.mCompare;
+				CopyFrom(_other);
+			}
+			return *this;
+		}
+		this_type& operator=(this_type&& _other) { swap(_other); return *this; }
+
+		const_reference top() const { return mpRoot->mVal; }
+		bool empty() const { return mSize == 0; }
+		size_type size() const { return mSize; }
+
+		void push(const value_type& _val) { emplace(_val); }
+		void push(value_type&& _val) { emplace(cckit::move(_val)); }
+
+		template<typename... Args>
+		void emplace(Args&&... _args) {
+			node_type* pNode = CreateNode(cckit::forward<Args>(_args)...);
+			mpRoot = mpRoot ? Link(mpRoot, pNode) : pNode;
+			++mSize;
+		}
+
+		void pop() {
+			node_type* pOldRoot = mpRoot;
+			mpRoot = MergePairs(pOldRoot->mpChild);
+			FreeNode(pOldRoot);
+			--mSize;
+		}
+
+		// pushes are constant time already, so a batch is simply linked in one after another
+		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
+		void push_range(InputIterator _first, InputIterator _last) {
+			for (; _first != _last; ++_first)
+				push(*_first);
+		}
+
+		template<typename OutputIterator>
+		OutputIterator pop_n(size_type _count, OutputIterator _out) {
+			for (; _count > 0 && mpRoot; --_count, ++_out) {
+				*_out = cckit::move(mpRoot->mVal);
+				pop();
+			}
+			return _out;
+		}
+
+		// moves every element of _other into this heap in constant time; _other is left empty
+		void meld(this_type& _other) {
+			if (this == &_other || !_other.mpRoot) return;
+			mpRoot = mpRoot ? Link(mpRoot, _other.mpRoot) : _other.mpRoot;
+			mSize += _other.mSize;
+			_other.mpRoot = nullptr;
+			_other.mSize = 0;
+		}
+
+		void clear() {
+			// the sibling links double as a work list, so no recursion or extra storage is needed
+			for (node_type* pList = mpRoot; pList;) {
+				node_type* pNode = pList;
+				pList = pNode->mpSibling;
+				if (node_type* pChild = pNode->mpChild) {
+					node_type* pTail = pChild;
+					for (; pTail->mpSibling; pTail = pTail->mpSibling) {}
+					pTail->mpSibling = pList;
+					pList = pChild;
+				}
+				FreeNode(pNode);
+			}
+			mpRoot = nullptr;
+			mSize = 0;
+		}
+
+		void swap(this_type& _other) {
+			cckit::swap(mpRoot, _other.mpRoot);
+			cckit::swap(mSize, _other.mSize);
+			cckit::swap(mCompare, _other.mCompare);
+		}
+
+		bool validate() const {
+			size_type count = 0;
+			cckit::vector<const node_type*> stack;
+			if (mpRoot) {
+				if (mpRoot->mpSibling)
+					return false;
+				stack.push_back(mpRoot);
+			}
+			while (!stack.empty()) {
+				const node_type* pNode = stack.back();
+				stack.pop_back();
+				++count;
+				for (const node_type* pChild = pNode->mpChild; pChild; pChild = pChild->mpSibling) {
+					if (mCompare(pNode->mVal, pChild->mVal))
+						return false;
+					stack.push_back(pChild);
+				}
+			}
+			return count == mSize;
+		}
+
+	private:
+		template<typename... Args>
+		node_type* CreateNode(Args&&... _args) {
+			return new(mAllocator.allocate(sizeof(node_type))) node_type(cckit::forward<Args>(_args)...);
+		}
+		void FreeNode(node_type* _pNode) {
+			_pNode->~node_type();
+			mAllocator.deallocate(_pNode);
+		}
+
+		// precondition: neither root has siblings
+		node_type* Link(node_type* _pRoot0, node_type* _pRoot1) {
+			if (mCompare(_pRoot0->mVal, _pRoot1->mVal))
+				cckit::swap(_pRoot0, _pRoot1);
+			_pRoot1->mpSibling = _pRoot0->mpChild;
+			_pRoot0->mpChild = _pRoot1;
+			return _pRoot0;
+		}
+
+		node_type* MergePairs(node_type* _pFirst) {
+			// first pass: link the trees left to right in pairs, collecting the results in reverse order
+			node_type* pPaired = nullptr;
+			while (_pFirst) {
+				node_type* pFirst = _pFirst;
+				node_type* pSecond = pFirst->mpSibling;
+				if (!pSecond) {
+					pFirst->mpSibling = pPaired;
+					pPaired = pFirst;
+					break;
+				}
+				_pFirst = pSecond->mpSibling;
+				pFirst->mpSibling = pSecond->mpSibling = nullptr;
+				node_type* pLinked = Link(pFirst, pSecond);
+				pLinked->mpSibling = pPaired;
+				pPaired = pLinked;
+			}
+			// second pass: accumulate the pairs right to left into a single tree
+			node_type* pRoot = nullptr;
+			while (pPaired) {
+				node_type* pNext = pPaired->mpSibling;
+				pPaired->mpSibling = nullptr;
+				pRoot = pRoot ? Link(pRoot, pPaired) : pPaired;
+				pPaired = pNext;
+			}
+			return pRoot;
+		}
+
+		void CopyFrom(const this_type& _other) {
+			cckit::vector<const node_type*> stack;
+			if (_other.mpRoot)
+				stack.push_back(_other.mpRoot);
+			while (!stack.empty()) {
+				const node_type* pNode = stack.back();
+				stack.pop_back();
+				push(pNode->mVal);
+				for (const node_type* pChild = pNode->mpChild; pChild; pChild = pChild->mpSibling)
+					stack.push_back(pChild);
+			}
+		}
+
+	private:
+		node_type* mpRoot;
+		size_type mSize;
+		value_compare mCompare;
+		allocator_type mAllocator;
+	};
+}
+
+#endif // !CCKIT_PAIRING_HEAP_H
\ No newline at end of file
@@ -0,0 +1,217 @@
+#ifndef CCKIT_RADIX_HEAP_H
+#define CCKIT_RADIX_HEAP_H
+
+#include "config.h"
+#include "bit_scan.h"
+#include "../vector.h"
+#include "../functional.h"
+#include "../type_traits.h"
+
+namespace cckit
+{
+	// maps an integral key onto an unsigned 64-bit radix that grows in the order elements leave the heap
+	template<typename T, typename Compare>
+	struct RadixHeapKey;
+	template<typename T>
+	struct RadixHeapKey<T, cckit::greater<T> >
+	{
+		static unsigned long long Get(T _val) {
+			return (T(-1) < T(0))
+				? static_cast<unsigned long long>(static_cast<long long>(_val)) ^ (1ull << 63)
+				: static_cast<unsigned long long>(_val);
+		}
+	};
+	template<typename T>
+	struct RadixHeapKey<T, cckit::less<T> >
+	{
+		static unsigned long long Get(T _val) { return ~RadixHeapKey<T, cckit::greater<T> >::Get(_val); }
+	};
+
+	/*
+	A radix heap is a monotone priority queue for integral keys: every pushed key must not precede the key that was popped
+	last, as is the case for event timestamps or Dijkstra distances. Elements are kept in 65 buckets according to the
+	highest bit in which they differ from the last popped key. pop() only redistributes the first non-empty bucket, and
+	every element can move down at most 64 times over its lifetime, so a pop costs amortized O(log C) for a key range C
+	without a single comparison against other elements. It can be plugged into priority_queue through its DataStructure
+	parameter:
+		cckit::priority_queue<int, cckit::vector<int>, cckit::greater<int>, cckit::radix_heap>
+
+	"Compare"
+	cckit::greater<T> pops keys in ascending order, cckit::less<T> in descending order.
+	*/
+	template<typename T, typename Container = cckit::vector<T>, typename Compare = cckit::less<T> >
+	class radix_heap
+	{
+		static_assert(is_integral<T>::value, "radix_heap requires integral keys");
+	private:
+		typedef radix_heap<T, Container, Compare> this_type;
+		typedef RadixHeapKey<T, Compare> key_type;
+		typedef cckit::vector<T> bucket_type;
+	public:
+		typedef Container container_type;
+		typedef Compare value_compare;
+		typedef typename Container::value_type value_type;
+		typedef typename Container::size_type size_type;
+		typedef typename Container::reference reference;
+		typedef typename Container::const_reference const_reference;
+
+		static const size_t BUCKET_COUNT = 65;
+
+	public:
+		radix_heap(const value_compare& _compare, const container_type& _container)
+			: mBuckets(), mBucketMins(), mSize(0), mLast(0), mCompare(_compare) {
+			for (auto current = _container.begin(), end = _container.end(); current != end; ++current)
+				push(*current);
+		}
+		radix_heap(const value_compare& _compare = value_compare(), container_type&& _container = container_type())
+			: mBuckets(), mBucketMins(), mSize(0), mLast(0), mCompare(_compare) {
+			for (auto current = _container.begin(), end = _container.end(); current != end; ++current)
+				push(*current);
+		}
+		radix_heap(const this_type& _other)
+			: mBuckets(), mBucketMins(), mSize(_other.mSize), mLast(_other.mLast), mCompare(_other.mCompare) {
+			for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+				mBuckets[i] = _other.mBuckets[i];
+				mBucketMins[i] = _other.mBucketMins[i];
+			}
+		}
+		radix_heap(this_type&& _other)
+			: mBuckets(), mBucketMins(), mSize(0), mLast(0), mCompare(_other.mCompare) {
+			swap(_other);
+		}
+		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
+		radix_heap(InputIterator _first, InputIterator _last, const value_compare& _compare, const container_type& _container)
+			: radix_heap(_compare, _container) {
+			for (; _first != _last; ++_first)
+				push(*_first);
+		}
+		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
+		radix_heap(InputIterator _first, InputIterator _last
+			, const value_compare& _compare = value_compare(), container_type&& _container = container_type())
+			: radix_heap(_compare, cckit::move(_container)) {
+			for (; _first != _last; ++_first)
+				push(*_first);
+		}
+
+		this_type& operator=(const this_type& _other) {
+			this_type temp = _other;
+			swap(temp);
+			return *this;
+		}
+		this_type& operator=(this_type&& _other) { swap(_other); return *this; }
+
+		// the minimum of the first non-empty bucket is tracked on insertion, so top() never has to redistribute
+		const_reference top() const {
+			size_t i = 0;
+			for (; mBuckets[i].empty(); ++i) {}
+			return mBuckets[i][mBucketMins[i]];
+		}
+		bool empty() const { return mSize == 0; }
+		size_type size() const { return mSize; }
+
+		void push(const value_type& _val) {
+			unsigned long long key = key_type::Get(_val);
+			if (mSize == 0 && key < mLast)
+				mLast = key;// nothing is bucketed relative to the old key, so an empty heap may restart lower
+			assert((key >= mLast));// keys have to be monotone
+			Insert(_val, key);
+			++mSize;
+		}
+		template<typename... Args>
+		void emplace(Args&&... _args) { push(value_type(cckit::forward<Args>(_args)...)); }
+
+		void pop() {
+			if (mBuckets[0].empty()) {
+				size_t i = 1;
+				for (; mBuckets[i].empty(); ++i) {}
+
+				bucket_type bucket;
+				bucket.swap(mBuckets[i]);
+				mLast = key_type::Get(bucket[mBucketMins[i]]);
+				for (auto current = bucket.begin(), end = bucket.end(); current != end; ++current)
+					Insert(*current, key_type::Get(*current));
+				// hand the emptied storage back so the bucket keeps its capacity
+				bucket.clear();
+				mBuckets[i].swap(bucket);
+			}
+			// bucket 0 only holds keys equal to the last popped one, but elements with equal keys may still differ, so
+			// the one top() reported is moved to the back before it goes
+			bucket_type& first = mBuckets[0];
+			if (mBucketMins[0] != first.size() - 1)
+				cckit::swap(first[mBucketMins[0]], first.back());
+			first.pop_back();
+			mBucketMins[0] = 0;
+			--mSize;
+		}
+
+		// empties every bucket but keeps its capacity, so a heap reused across searches stops allocating
+		void clear() {
+			for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+				mBuckets[i].clear();
+				mBucketMins[i] = 0;
+			}
+			mSize = 0;
+			mLast = 0;
+		}
+
+		template<typename InputIterator, enable_if_t<cckit::is_iterator<InputIterator>::value>* = 0>
+		void push_range(InputIterator _first, InputIterator _last) {
+			for (; _first != _last; ++_first)
+				push(*_first);
+		}
+
+		template<typename OutputIterator>
+		OutputIterator pop_n(size_type _count, OutputIterator _out) {
+			for (; _count > 0 && mSize > 0; --_count, ++_out) {
+				*_out = top();
+				pop();
+			}
+			return _out;
+		}
+
+		void swap(this_type& _other) {
+			for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+				mBuckets[i].swap(_other.mBuckets[i]);
+				cckit::swap(mBucketMins[i], _other.mBucketMins[i]);
+			}
+			cckit::swap(mSize, _other.mSize);
+			cckit::swap(mLast, _other.mLast);
+		}
+
+		bool validate() const {
+			size_type count = 0;
+			for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+				for (size_t j = 0; j < mBuckets[i].size(); ++j) {
+					unsigned long long key = key_type::Get(mBuckets[i][j]);
+					if (key < mLast || BucketIndex(key) != i || key < key_type::Get(mBuckets[i][mBucketMins[i]]))
+						return false;
+				}
+				count += mBuckets[i].size();
+			}
+			return count == mSize;
+		}
+
+	private:
+		size_t BucketIndex(unsigned long long _key) const {
+			uint64_t diff = _key ^ mLast;
+			return diff ? 64 - leading_zeros(diff) : 0;
+		}
+
+		void Insert(const value_type& _val, unsigned long long _key) {
+			size_t i = BucketIndex(_key);
+			bucket_type& bucket = mBuckets[i];
+			if (bucket.empty() || _key < key_type::Get(bucket[mBucketMins[i]]))
+				mBucketMins[i] = bucket.size();
+			bucket.push_back(_val);
+		}
+
+	private:
+		bucket_type mBuckets[BUCKET_COUNT];
+		size_t mBucketMins[BUCKET_COUNT];// index of the smallest key within each bucket
+		size_type mSize;
+		unsigned long long mLast;
+		value_compare mCompare;
+	};
+}
+
+#endif // !CCKIT_RADIX_HEAP_H
\ No newline at end of file
@@ -0,0 +1,566 @@
+#ifndef CCKIT_DYNAMIC_MATRIX_H
+#define CCKIT_DYNAMIC_MATRIX_H
+
+#include "../internal/config.h"
+#include "../thread_pool.h"
+#include "matrix.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif // _MSC_VER
+
+namespace cckit
+{
+	/*
+	A rows x cols matrix of an arithmetic T whose dimensions are only known at run time. The elements live on the heap in
+	row-major order, every row starting on a cache line: stride() elements apart, the padding past cols() being zero.
+	So rows can be handed to matrix_multiply() and the SIMD kernels without any copy, and a fixed-size matrix converts
+	both ways.
+	*/
+	template<typename T = double>
+	class dynamic_matrix
+	{
+		typedef dynamic_matrix<T> this_type;
+	public:
+		typedef T value_type;
+
+		dynamic_matrix() : mpData(nullptr), mRows(0), mCols(0), mStride(0) {}
+		dynamic_matrix(size_t _rows, size_t _cols, const T& _val = T());
+		template<int Row, int Col>
+		explicit dynamic_matrix(const matrix<Row, Col, T>& _mat);
+		dynamic_matrix(const this_type& _other);
+		dynamic_matrix(this_type&& _other) CCKIT_NOEXCEPT;
+		~dynamic_matrix();
+		this_type& operator=(const this_type& _rhs);
+		this_type& operator=(this_type&& _rhs) CCKIT_NOEXCEPT;
+
+		static this_type identity(size_t _size);
+
+		size_t rows() const { return mRows; }
+		size_t cols() const { return mCols; }
+		// the distance between the beginnings of consecutive rows, in elements
+		size_t stride() const { return mStride; }
+		const T* data() const { return mpData; }
+		T* data() { return mpData; }
+
+		T at(size_t _row, size_t _col) const { return mpData[_row * mStride + _col]; }
+		T& at(size_t _row, size_t _col) { return mpData[_row * mStride + _col]; }
+		const T* operator[](size_t _row) const { return mpData + _row * mStride; }
+		T* operator[](size_t _row) { return mpData + _row * mStride; }
+
+		// the matrix as a fixed-size one, whose dimensions have to match
+		template<int Row, int Col>
+		matrix<Row, Col, T> to_matrix() const;
+		this_type transpose() const;
+		void swap(this_type& _other) CCKIT_NOEXCEPT;
+
+	private:
+		T* mpData;
+		size_t mRows;
+		size_t mCols;
+		size_t mStride;
+	};
+
+	template<typename T>
+	dynamic_matrix<T> multiply(const dynamic_matrix<T>& _mat0, const dynamic_matrix<T>& _mat1);
+	// the same product, with bands of rows of the result computed concurrently on _pool
+	template<typename T>
+	dynamic_matrix<T> multiply(const dynamic_matrix<T>& _mat0, const dynamic_matrix<T>& _mat1, thread_pool& _pool);
+
+	/*
+	The factorization P * A = L * U of a square dynamic_matrix of float or double, by Gaussian elimination with partial
+	pivoting. It is blocked: every MATRIX_BLOCK_SIZE columns, a narrow panel is factored as in lu_decomposition, and
+	the rest of the matrix is then updated by one matrix_multiply_add(), which does nearly all the arithmetic at the
+	speed of the multiply kernels. Given a thread_pool, bands of rows of that update run concurrently.
+	*/
+	template<typename T = double>
+	class dynamic_lu_decomposition
+	{
+		typedef dynamic_lu_decomposition<T> this_type;
+	public:
+		typedef dynamic_matrix<T> matrix_type;
+
+		explicit dynamic_lu_decomposition(const matrix_type& _mat);
+		dynamic_lu_decomposition(const matrix_type& _mat, thread_pool& _pool);
+
+		// true if some column had no nonzero pivot; determinant() is then 0, and solve() and inverse() are meaningless
+		bool singular() const { return mSingular; }
+		T determinant() const;
+		// the X with A * X = _rhs, for any number of right-hand side columns
+		matrix_type solve(const matrix_type& _rhs) const;
+		matrix_type inverse() const;
+
+		const matrix_type& lu() const { return mLU; }
+		// row i of P * A is row pivot(i) of A
+		size_t pivot(size_t _row) const { return mPivots[_row]; }
+
+	private:
+		void Factor(thread_pool* _pPool);
+
+	private:
+		matrix_type mLU;
+		std::vector<size_t> mPivots;
+		bool mOddPermutation;
+		bool mSingular;
+	};
+
+	/*
+	The factorization A = L * L^T of a symmetric positive definite dynamic_matrix of float or double, blocked like
+	dynamic_lu_decomposition but without pivoting and with half the arithmetic: only the lower triangle of A is read,
+	and the update of every block only touches the lower triangle of the rest.
+	*/
+	template<typename T = double>
+	class dynamic_cholesky_decomposition
+	{
+		typedef dynamic_cholesky_decomposition<T> this_type;
+	public:
+		typedef dynamic_matrix<T> matrix_type;
+
+		explicit dynamic_cholesky_decomposition(const matrix_type& _mat);
+		dynamic_cholesky_decomposition(const matrix_type& _mat, thread_pool& _pool);
+
+		// false if A turned out not to be positive definite, in which case nothing else is meaningful
+		bool positive_definite() const { return mPositiveDefinite; }
+		T determinant() const;
+		matrix_type solve(const matrix_type& _rhs) const;
+
+		// L, with zeros above the diagonal
+		const matrix_type& lower() const { return mL; }
+
+	private:
+		void Factor(thread_pool* _pPool);
+
+	private:
+		matrix_type mL;
+		bool mPositiveDefinite;
+	};
+}
+
+namespace cckit
+{
+	namespace
+	{
+		const size_t MATRIX_ROW_ALIGNMENT = 64;// a cache line
+		// the columns factored per panel by the blocked decompositions, and the rows per task of their parallel updates
+		const size_t MATRIX_BLOCK_SIZE = 64;
+
+		inline void* MatrixAllocate(size_t _size)
+		{
+			void* pData = nullptr;
+#ifdef _MSC_VER
+			pData = _aligned_malloc(_size, MATRIX_ROW_ALIGNMENT);
+#else
+			if (posix_memalign(&pData, MATRIX_ROW_ALIGNMENT, _size) != 0)
+				pData = nullptr;
+#endif // _MSC_VER
+			if (!pData)
+				throw std::bad_alloc();
+			return pData;
+		}
+
+		inline void MatrixFree(void* _pData)
+		{
+#ifdef _MSC_VER
+			_aligned_free(_pData);
+#else
+			std::free(_pData);
+#endif // _MSC_VER
+		}
+
+		// _dst[row] -= _factor * _src[row] over _count elements
+		template<typename T>
+		inline void MatrixSubtractRow(T* _dst, const T* _src, T _factor, size_t _count)
+		{
+			for (size_t col = 0; col < _count; ++col)
+				_dst[col] -= _factor * _src[col];
+		}
+	}
+
+	template<typename T>
+	inline dynamic_matrix<T>::dynamic_matrix(size_t _rows, size_t _cols, const T& _val)
+		: mpData(nullptr), mRows(_rows), mCols(_cols), mStride(0)
+	{
+		const size_t rowElements = MATRIX_ROW_ALIGNMENT / sizeof(T);
+		mStride = (_cols + rowElements - 1) / rowElements * rowElements;
+		if (_rows == 0 || mStride == 0) return;
+
+		mpData = static_cast<T*>(MatrixAllocate(_rows * mStride * sizeof(T)));
+		for (size_t row = 0; row < _rows; ++row) {
+			T* pRow = mpData + row * mStride;
+			for (size_t col = 0; col < _cols; ++col)
+				pRow[col] = _val;
+			for (size_t col = _cols; col < mStride; ++col)
+				pRow[col] = T();
+		}
+	}
+
+	template<typename T>
+	template<int Row, int Col>
+	inline dynamic_matrix<T>::dynamic_matrix(const matrix<Row, Col, T>& _mat)
+		: dynamic_matrix(Row, Col)
+	{
+		for (int row = 0; row < Row; ++row)
+			std::memcpy((*this)[row], _mat.mArray[row], Col * sizeof(T));
+	}
+
+	template<typename T>
+	inline dynamic_matrix<T>::dynamic_matrix(const this_type& _other)
+		: mpData(nullptr), mRows(_other.mRows), mCols(_other.mCols), mStride(_other.mStride)
+	{
+		if (!_other.mpData) return;
+		mpData = static_cast<T*>(MatrixAllocate(mRows * mStride * sizeof(T)));
+		std::memcpy(mpData, _other.mpData, mRows * mStride * sizeof(T));
+	}
+
+	template<typename T>
+	inline dynamic_matrix<T>::dynamic_matrix(this_type&& _other) CCKIT_NOEXCEPT
+		: mpData(_other.mpData), mRows(_other.mRows), mCols(_other.mCols), mStride(_other.mStride)
+	{
+		_other.mpData = nullptr;
+		_other.mRows = _other.mCols = _other.mStride = 0;
+	}
+
+	template<typename T>
+	inline dynamic_matrix<T>::~dynamic_matrix()
+	{
+		if (mpData)
+			MatrixFree(mpData);
+	}
+
+	template<typename T>
+	inline typename dynamic_matrix<T>::this_type& dynamic_matrix<T>::operator=(const this_type& _rhs)
+	{
+		if (this != &_rhs) {
+			this_type copy(_rhs);
+			swap(copy);
+		}
+		return *this;
+	}
+
+	template<typename T>
+	inline typename dynamic_matrix<T>::this_type& dynamic_matrix<T>::operator=(this_type&& _rhs) CCKIT_NOEXCEPT
+	{
+		swap(_rhs);
+		return *this;
+	}
+
+	template<typename T>
+	inline typename dynamic_matrix<T>::this_type dynamic_matrix<T>::identity(size_t _size)
+	{
+		this_type identityMat(_size, _size);
+		for (size_t i = 0; i < _size; ++i)
+			identityMat.at(i, i) = T(1);
+		return identityMat;
+	}
+
+	template<typename T>
+	template<int Row, int Col>
+	inline matrix<Row, Col, T> dynamic_matrix<T>::to_matrix() const
+	{
+		assert((mRows == static_cast<size_t>(Row) && mCols == static_cast<size_t>(Col)));
+		matrix<Row, Col, T> fixedMat;
+		for (int row = 0; row < Row; ++row)
+			std::memcpy(fixedMat.mArray[row], (*this)[row], Col * sizeof(T));
+		return fixedMat;
+	}
+
+	// copies square tiles, so that neither the rows read nor the rows written stray far from the cache
+	template<typename T>
+	inline typename dynamic_matrix<T>::this_type dynamic_matrix<T>::transpose() const
+	{
+		const size_t tile = MATRIX_ROW_ALIGNMENT / sizeof(T);
+		this_type transposeMat(mCols, mRows);
+		for (size_t row0 = 0; row0 < mRows; row0 += tile) {
+			size_t row1 = (mRows - row0 < tile) ? mRows : row0 + tile;
+			for (size_t col0 = 0; col0 < mCols; col0 += tile) {
+				size_t col1 = (mCols - col0 < tile) ? mCols : col0 + tile;
+				for (size_t row = row0; row < row1; ++row)
+					for (size_t col = col0; col < col1; ++col)
+						transposeMat.at(col, row) = at(row, col);
+			}
+		}
+		return transposeMat;
+	}
+
+	template<typename T>
+	inline void dynamic_matrix<T>::swap(this_type& _other) CCKIT_NOEXCEPT
+	{
+		T* pData = mpData; mpData = _other.mpData; _other.mpData = pData;
+		size_t rows = mRows; mRows = _other.mRows; _other.mRows = rows;
+		size_t cols = mCols; mCols = _other.mCols; _other.mCols = cols;
+		size_t stride = mStride; mStride = _other.mStride; _other.mStride = stride;
+	}
+
+	template<typename T>
+	inline dynamic_matrix<T> multiply(const dynamic_matrix<T>& _mat0, const dynamic_matrix<T>& _mat1)
+	{
+		assert((_mat0.cols() == _mat1.rows()));
+		dynamic_matrix<T> resultMat(_mat0.rows(), _mat1.cols());
+		cckit::matrix_multiply(_mat0.data(), _mat0.stride(), _mat1.data(), _mat1.stride(), resultMat.data(), resultMat.stride()
+			, _mat0.rows(), _mat1.cols(), _mat0.cols());
+		return resultMat;
+	}
+
+	template<typename T>
+	inline dynamic_matrix<T> multiply(const dynamic_matrix<T>& _mat0, const dynamic_matrix<T>& _mat1, thread_pool& _pool)
+	{
+		assert((_mat0.cols() == _mat1.rows()));
+		dynamic_matrix<T> resultMat(_mat0.rows(), _mat1.cols());
+		// every band reads all of _mat1 and writes only its own rows of the result
+		_pool.parallel_for(0, _mat0.rows(), MATRIX_BLOCK_SIZE, [&](size_t _first, size_t _last) {
+			cckit::matrix_multiply(_mat0[_first], _mat0.stride(), _mat1.data(), _mat1.stride(), resultMat[_first], resultMat.stride()
+				, _last - _first, _mat1.cols(), _mat0.cols());
+		});
+		return resultMat;
+	}
+
+	template<typename T>
+	inline dynamic_lu_decomposition<T>::dynamic_lu_decomposition(const matrix_type& _mat)
+		: mLU(_mat), mPivots(), mOddPermutation(false), mSingular(false)
+	{
+		Factor(nullptr);
+	}
+
+	template<typename T>
+	inline dynamic_lu_decomposition<T>::dynamic_lu_decomposition(const matrix_type& _mat, thread_pool& _pool)
+		: mLU(_mat), mPivots(), mOddPermutation(false), mSingular(false)
+	{
+		Factor(&_pool);
+	}
+
+	template<typename T>
+	void dynamic_lu_decomposition<T>::Factor(thread_pool* _pPool)
+	{
+		assert((mLU.rows() == mLU.cols()));
+		const size_t size = mLU.rows(), stride = mLU.stride();
+		mPivots.resize(size);
+		for (size_t row = 0; row < size; ++row)
+			mPivots[row] = row;
+
+		std::vector<T> panel;
+		for (size_t block = 0; block < size; block += MATRIX_BLOCK_SIZE) {
+			const size_t blockEnd = (size - block < MATRIX_BLOCK_SIZE) ? size : block + MATRIX_BLOCK_SIZE;
+			const size_t width = blockEnd - block;
+
+			// the panel of columns [block, blockEnd), unblocked, swapping whole rows
+			for (size_t col = block; col < blockEnd; ++col) {
+				size_t pivotRow = col;
+				T largestAbs = std::abs(mLU.at(col, col));
+				for (size_t row = col + 1; row < size; ++row) {
+					T absVal = std::abs(mLU.at(row, col));
+					if (largestAbs < absVal) {
+						largestAbs = absVal;
+						pivotRow = row;
+					}
+				}
+				if (largestAbs == 0) {
+					mSingular = true;
+					continue;
+				}
+				if (pivotRow != col) {
+					T* pRow0 = mLU[pivotRow];
+					T* pRow1 = mLU[col];
+					for (size_t i = 0; i < size; ++i) {
+						T temp = pRow0[i];
+						pRow0[i] = pRow1[i];
+						pRow1[i] = temp;
+					}
+					size_t temp = mPivots[pivotRow];
+					mPivots[pivotRow] = mPivots[col];
+					mPivots[col] = temp;
+					mOddPermutation = !mOddPermutation;
+				}
+
+				T reciprocal = T(1) / mLU.at(col, col);
+				for (size_t row = col + 1; row < size; ++row) {
+					T factor = (mLU.at(row, col) *= reciprocal);
+					MatrixSubtractRow(mLU[row] + col + 1, mLU[col] + col + 1, factor, blockEnd - col - 1);
+				}
+			}
+			if (blockEnd == size) break;
+
+			// U12 = L11^-1 * A12, the rows of the block to the right of the panel
+			for (size_t row = block + 1; row < blockEnd; ++row)
+				for (size_t k = block; k < row; ++k)
+					MatrixSubtractRow(mLU[row] + blockEnd, mLU[k] + blockEnd, mLU.at(row, k), size - blockEnd);
+
+			// A22 -= L21 * U12, as A22 += (-L21) * U12 with -L21 packed contiguously
+			const size_t rest = size - blockEnd;
+			panel.resize(rest * width);
+			for (size_t row = 0; row < rest; ++row)
+				for (size_t k = 0; k < width; ++k)
+					panel[row * width + k] = -mLU.at(blockEnd + row, block + k);
+			const T* pPanel = panel.data();
+			T* pU12 = mLU[block] + blockEnd;
+			T* pA22 = mLU[blockEnd] + blockEnd;
+			cckit::parallel_for(_pPool, 0, rest, MATRIX_BLOCK_SIZE, [=](size_t _first, size_t _last) {
+				cckit::matrix_multiply_add(pPanel + _first * width, width, pU12, stride, pA22 + _first * stride, stride
+					, _last - _first, rest, width);
+			});
+		}
+	}
+
+	template<typename T>
+	inline T dynamic_lu_decomposition<T>::determinant() const
+	{
+		if (mSingular) return 0;
+		T result = mOddPermutation ? T(-1) : T(1);
+		for (size_t i = 0; i < mLU.rows(); ++i)
+			result *= mLU.at(i, i);
+		return result;
+	}
+
+	template<typename T>
+	inline typename dynamic_lu_decomposition<T>::matrix_type dynamic_lu_decomposition<T>::solve(const matrix_type& _rhs) const
+	{
+		assert((_rhs.rows() == mLU.rows()));
+		const size_t size = mLU.rows(), count = _rhs.cols();
+		matrix_type result(size, count);
+
+		// L * Y = P * B, then U * X = Y, a row of the result at a time
+		for (size_t row = 0; row < size; ++row) {
+			std::memcpy(result[row], _rhs[mPivots[row]], count * sizeof(T));
+			for (size_t k = 0; k < row; ++k)
+				MatrixSubtractRow(result[row], result[k], mLU.at(row, k), count);
+		}
+		for (size_t row = size; row-- > 0;) {
+			for (size_t k = row + 1; k < size; ++k)
+				MatrixSubtractRow(result[row], result[k], mLU.at(row, k), count);
+			T reciprocal = T(1) / mLU.at(row, row);
+			for (size_t col = 0; col < count; ++col)
+				result.at(row, col) *= reciprocal;
+		}
+		return result;
+	}
+
+	template<typename T>
+	inline typename dynamic_lu_decomposition<T>::matrix_type dynamic_lu_decomposition<T>::inverse() const
+	{
+		return solve(matrix_type::identity(mLU.rows()));
+	}
+
+	template<typename T>
+	inline dynamic_cholesky_decomposition<T>::dynamic_cholesky_decomposition(const matrix_type& _mat)
+		: mL(_mat), mPositiveDefinite(true)
+	{
+		Factor(nullptr);
+	}
+
+	template<typename T>
+	inline dynamic_cholesky_decomposition<T>::dynamic_cholesky_decomposition(const matrix_type& _mat, thread_pool& _pool)
+		: mL(_mat), mPositiveDefinite(true)
+	{
+		Factor(&_pool);
+	}
+
+	template<typename T>
+	void dynamic_cholesky_decomposition<T>::Factor(thread_pool* _pPool)
+	{
+		assert((mL.rows() == mL.cols()));
+		const size_t size = mL.rows(), stride = mL.stride();
+
+		std::vector<T> panel, panelTranspose;
+		for (size_t block = 0; block < size && mPositiveDefinite; block += MATRIX_BLOCK_SIZE) {
+			const size_t blockEnd = (size - block < MATRIX_BLOCK_SIZE) ? size : block + MATRIX_BLOCK_SIZE;
+			const size_t width = blockEnd - block;
+
+			// L11, the diagonal block, unblocked
+			for (size_t col = block; col < blockEnd; ++col) {
+				T diagonal = mL.at(col, col);
+				for (size_t k = block; k < col; ++k)
+					diagonal -= mL.at(col, k) * mL.at(col, k);
+				if (!(diagonal > 0)) {
+					mPositiveDefinite = false;
+					break;
+				}
+				diagonal = std::sqrt(diagonal);
+				mL.at(col, col) = diagonal;
+				for (size_t row = col + 1; row < blockEnd; ++row) {
+					T sum = mL.at(row, col);
+					for (size_t k = block; k < col; ++k)
+						sum -= mL.at(row, k) * mL.at(col, k);
+					mL.at(row, col) = sum / diagonal;
+				}
+			}
+			if (!mPositiveDefinite || blockEnd == size) break;
+
+			// L21 = A21 * L11^-T, every row on its own
+			matrix_type& l = mL;
+			cckit::parallel_for(_pPool, blockEnd, size, MATRIX_BLOCK_SIZE, [&l, block, blockEnd](size_t _first, size_t _last) {
+				for (size_t row = _first; row < _last; ++row) {
+					T* pRow = l[row];
+					for (size_t col = block; col < blockEnd; ++col) {
+						const T* pCol = l[col];
+						T sum = pRow[col];
+						for (size_t k = block; k < col; ++k)
+							sum -= pRow[k] * pCol[k];
+						pRow[col] = sum / pCol[col];
+					}
+				}
+			});
+
+			// A22 -= L21 * L21^T on and below the diagonal: a band of rows only needs the columns up to its last row
+			const size_t rest = size - blockEnd;
+			panel.resize(rest * width);
+			panelTranspose.resize(width * rest);
+			for (size_t row = 0; row < rest; ++row) {
+				for (size_t k = 0; k < width; ++k) {
+					T val = mL.at(blockEnd + row, block + k);
+					panel[row * width + k] = -val;
+					panelTranspose[k * rest + row] = val;
+				}
+			}
+			const T* pPanel = panel.data();
+			const T* pPanelTranspose = panelTranspose.data();
+			T* pA22 = mL[blockEnd] + blockEnd;
+			cckit::parallel_for(_pPool, 0, rest, MATRIX_BLOCK_SIZE, [=](size_t _first, size_t _last) {
+				cckit::matrix_multiply_add(pPanel + _first * width, width, pPanelTranspose, rest, pA22 + _first * stride, stride
+					, _last - _first, _last, width);
+			});
+		}
+
+		for (size_t row = 0; row < size; ++row)
+			for (size_t col = row + 1; col < size; ++col)
+				mL.at(row, col) = T();
+	}
+
+	template<typename T>
+	inline T dynamic_cholesky_decomposition<T>::determinant() const
+	{
+		T result = T(1);
+		for (size_t i = 0; i < mL.rows(); ++i)
+			result *= mL.at(i, i);
+		return result * result;
+	}
+
+	template<typename T>
+	inline typename dynamic_cholesky_decomposition<T>::matrix_type dynamic_cholesky_decomposition<T>::solve(const matrix_type& _rhs) const
+	{
+		assert((_rhs.rows() == mL.rows()));
+		const size_t size = mL.rows(), count = _rhs.cols();
+		matrix_type result(_rhs);
+
+		// L * Y = B, then L^T * X = Y; the latter walks L by rows too, pushing every finished row of X up
+		for (size_t row = 0; row < size; ++row) {
+			for (size_t k = 0; k < row; ++k)
+				MatrixSubtractRow(result[row], result[k], mL.at(row, k), count);
+			T reciprocal = T(1) / mL.at(row, row);
+			for (size_t col = 0; col < count; ++col)
+				result.at(row, col) *= reciprocal;
+		}
+		for (size_t row = size; row-- > 0;) {
+			T reciprocal = T(1) / mL.at(row, row);
+			for (size_t col = 0; col < count; ++col)
+				result.at(row, col) *= reciprocal;
+			for (size_t k = 0; k < row; ++k)
+				MatrixSubtractRow(result[k], result[row], mL.at(row, k), count);
+		}
+		return result;
+	}
+}
+
+#endif // !CCKIT_DYNAMIC_MATRIX_H
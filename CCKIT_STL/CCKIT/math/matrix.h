@@ -2,21 +2,63 @@
 #define CCKIT_MATRIX_H
 
 #include "../internal/config.h"
+#include "../type_traits.h"
 #include <initializer_list>
 #include <cmath>
+#include <cstddef>
+#ifdef CCKIT_SSE2
+#include <emmintrin.h>
+#endif // CCKIT_SSE2
+#ifdef CCKIT_AVX
+#include <immintrin.h>
+#endif // CCKIT_AVX
 //#include "../math.h"
 
 namespace cckit 
 {
-	template<int Row, int Col>
-	struct matrix
+	template<int Length, typename T = double>
+	class lu_decomposition;
+
+	namespace
+	{
+		// the alignment of a matrix's storage: that of an SSE register where the size allows it without padding, unless
+		// that is more than operator new guarantees, since before C++17 containers ignore over-alignment
+		template<size_t Size, size_t Alignment>
+		struct MatrixAlignment : public integral_constant<size_t
+			, (Size % 16 == 0 && alignof(std::max_align_t) >= 16) ? 16 : Alignment> {};
+
+		// the type a matrix of T is factored and inverted in: double for integral types, whose inverses are fractions
+		template<typename T>
+		using MatrixFactor = conditional_t<is_integral<T>::value, double, T>;
+	}
+
+	/*
+	The base of matrix and of the lazy expressions built from matrices by +, -, scalar *, transpose() and *, through which
+	operators and assignment recognize them. Every Derived has ROW, COL and value_type like a matrix, an evaluator that
+	reads element (row, col), ALIAS_SAFE, and references(), whether it reads the matrix at the given address.
+	*/
+	template<typename Derived>
+	struct matrix_expression
+	{
+		const Derived& derived() const { return static_cast<const Derived&>(*this); }
+	};
+
+	/*
+	A Row x Col matrix of T (float, double or an integral type) stored inline in row-major order. The storage is aligned to
+	16 bytes when its size is a multiple of that, so rows of 4x4 float matrices start on a register boundary; the SIMD
+	kernels still load unaligned, which costs nothing on aligned data and keeps them usable on any row-major block.
+	*/
+	template<int Row, int Col, typename T = double>
+	struct matrix : public matrix_expression<matrix<Row, Col, T> >
 	{
-		double mArray[Row][Col];
+		typedef T value_type;
+
+		alignas(MatrixAlignment<sizeof(T) * Row * Col, alignof(T)>::value) T mArray[Row][Col];
 		const static int ROW = Row;
 		const static int COL = Col;
 
 		matrix() {}
-		matrix(std::initializer_list<std::initializer_list<double> > _ilist) 
+		matrix(std::initializer_list<std::initializer_list<T> > _ilist) 
 		{
 			auto rowIter = _ilist.begin();
 			for (int row = 0; row < Row; ++row, ++rowIter) {
@@ -26,51 +68,53 @@ namespace cckit
 				}
 			}
 		}
-		matrix(const matrix<Row, Col>& _other) {
-			for (int row = 0; row < Row; ++row)
-				for (int col = 0; col < Col; ++col)
-					mArray[row][col] = _other.mArray[row][col];
-		}
+		// defaulted so that matrices stay trivially copyable and arrays of them move with memcpy
+		matrix(const matrix<Row, Col, T>& _other) = default;
+		// evaluates an expression in a single loop over the elements, with no intermediate matrices
+		template<typename Expression>
+		matrix(const matrix_expression<Expression>& _expr);
+		template<typename Expression>
+		matrix<Row, Col, T>& operator=(const matrix_expression<Expression>& _expr);
 
-		double at(int _row, int _col) const {
+		T at(int _row, int _col) const {
 			return mArray[_row][_col];
 		}
-		double& at(int _row, int _col) {
+		T& at(int _row, int _col) {
 			return mArray[_row][_col];
 		}
 
-		const double* operator[](int _row) const {
+		const T* operator[](int _row) const {
 			return mArray[_row];
 		}
-		double* operator[](int _row) {
+		T* operator[](int _row) {
 			return mArray[_row];
 		}
 
-		matrix<Col, Row> transpose() const {
-			matrix<Col, Row> transposeMat;
+		// the transpose, computed right away; cckit::transpose() returns it as a lazy expression instead
+		matrix<Col, Row, T> transpose() const {
+			matrix<Col, Row, T> transposeMat;
 			for (int row = 0; row < Row; ++row)
 				for (int col = 0; col < Col; ++col)
-					transposeMat.mArray[row][col] = mArray[col][row];
+					transposeMat.mArray[col][row] = mArray[row][col];
 			return transposeMat;
 		}
 
-		template<typename = cckit::enable_if_t<(Row == Col)> >
-		matrix<Row, Col> inverse() const {
-			double det = determinant(*this);
-
-			if (det != 0) {
-				matrix<Row, Col> inverseMat;
-				for (int row = 0; row < Row; ++row)
-					for (int col = 0; col < Col; ++col)
-						inverseMat.mArray[row][col] = transpose().cofactor(row, col) / det;
-				return inverseMat;
-			}
-			return *this;
+		// returns *this unchanged if the matrix is singular; factor once with lu_decomposition to also solve or take the determinant
+		template<int Length = Row, typename = cckit::enable_if_t<(Length == Col)> >
+		matrix<Row, Col, MatrixFactor<T> > inverse() const {
+			lu_decomposition<Row, T> lu(*this);
+			if (!lu.singular())
+				return lu.inverse();
+			matrix<Row, Col, MatrixFactor<T> > copy;
+			for (int row = 0; row < Row; ++row)
+				for (int col = 0; col < Col; ++col)
+					copy.mArray[row][col] = static_cast<MatrixFactor<T> >(mArray[row][col]);
+			return copy;
 		}
 
-		template<typename = cckit::enable_if_t<(Row == Col)> >
-		matrix<Row, Col> inverse_gauss_jordan_elimination() const {
-			matrix<Row, Col> inverseMat, auxMat = *this;
+		template<int Length = Row, typename = cckit::enable_if_t<(Length == Col)> >
+		matrix<Row, Col, T> inverse_gauss_jordan_elimination() const {
+			matrix<Row, Col, T> inverseMat, auxMat = *this;
 
 			for (int row = 0; row < Row; ++row)
 				for (int col = 0; col < Col; ++col)
@@ -79,9 +123,9 @@ namespace cckit
 			for (int j = 0; j < Col; ++j) {
 				int i = 0;
 
-				double largestAbs = 0;
+				T largestAbs = 0;
 				for (int row = j; row < Row; ++row) {
-					double absVal = cckit::abs(auxMat.mArray[row][j]);
+					T absVal = cckit::abs(auxMat.mArray[row][j]);
 					if (largestAbs < absVal) {
 						largestAbs = absVal;
 						i = row;
@@ -118,13 +162,14 @@ namespace cckit
 			return inverseMat;
 		}
 
-		double cofactor(int _row, int _col) const {
-			return std::pow(-1, _row + _col) * determinant(minor(_row, _col));
+		T cofactor(int _row, int _col) const {
+			T minorDet = determinant(minor(_row, _col));
+			return ((_row + _col) % 2 != 0) ? -minorDet : minorDet;
 		}
 
-		template<typename = cckit::enable_if_t<(Row > 1 && Col > 1)> >
-		matrix<Row - 1, Col - 1> minor(int _row, int _col) const {
-			matrix<Row - 1, Col - 1> minorMat;
+		template<int Length = Row, typename = cckit::enable_if_t<(Length > 1 && Col > 1)> >
+		matrix<Row - 1, Col - 1, T> minor(int _row, int _col) const {
+			matrix<Row - 1, Col - 1, T> minorMat;
 			for (int row = 0; row < _row; ++row) {
 				for (int col = 0; col < _col; ++col)
 					minorMat.mArray[row][col] = mArray[row][col];
@@ -139,31 +184,788 @@ namespace cckit
 			}
 			return minorMat;
 		}
+
+		// as a matrix_expression
+		static const bool ALIAS_SAFE = true;
+		class evaluator
+		{
+		public:
+			explicit evaluator(const matrix<Row, Col, T>& _mat) : mArray(_mat.mArray) {}
+			T operator()(int _row, int _col) const { return mArray[_row][_col]; }
+		private:
+			const T (*mArray)[Col];
+		};
+		bool references(const void* _pMat) const { return _pMat == this; }
 	};
 
-	template<int i, int j, int k>
-	matrix<i, k> multiply(const matrix<i, j>& _mat0, const matrix<j, k>& _mat1) {
-		matrix<i, k> resultMat;
+	namespace
+	{
+		// one element per "register": the fallback for types without a SIMD specialization and for leftover columns
+		template<typename T>
+		struct MatrixScalar
+		{
+			typedef T vector_type;
+			static const size_t WIDTH = 1;
+
+			static vector_type Zero() { return T(); }
+			static vector_type Broadcast(T _val) { return _val; }
+			static vector_type Load(const T* _ptr) { return *_ptr; }
+			static void Store(T* _ptr, vector_type _v) { *_ptr = _v; }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) { return _acc + _a * _b; }
+		};
+
+		// 128-bit registers, for matrices narrower than a 256-bit one
+		template<typename T>
+		struct MatrixSse : public MatrixScalar<T> {};
+		// the widest registers the target guarantees for T
+		template<typename T>
+		struct MatrixSimd : public MatrixSse<T> {};
+
+#ifdef CCKIT_SSE2
+		template<>
+		struct MatrixSse<float>
+		{
+			typedef __m128 vector_type;
+			static const size_t WIDTH = 4;
+
+			static vector_type Zero() { return _mm_setzero_ps(); }
+			static vector_type Broadcast(float _val) { return _mm_set1_ps(_val); }
+			static vector_type Load(const float* _ptr) { return _mm_loadu_ps(_ptr); }
+			static void Store(float* _ptr, vector_type _v) { _mm_storeu_ps(_ptr, _v); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm_add_ps(_acc, _mm_mul_ps(_a, _b));
+			}
+		};
+		template<>
+		struct MatrixSse<double>
+		{
+			typedef __m128d vector_type;
+			static const size_t WIDTH = 2;
 
-		for (int row = 0; row < i; ++row) {
-			for (int col = 0; col < k; ++col) {
-				resultMat.at(row, col) = 0;
-				for (int jCurrent = 0; jCurrent < j; ++jCurrent)
-					resultMat.at(row, col) += _mat0.at(row, jCurrent) * _mat1.at(jCurrent, col);
+			static vector_type Zero() { return _mm_setzero_pd(); }
+			static vector_type Broadcast(double _val) { return _mm_set1_pd(_val); }
+			static vector_type Load(const double* _ptr) { return _mm_loadu_pd(_ptr); }
+			static void Store(double* _ptr, vector_type _v) { _mm_storeu_pd(_ptr, _v); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm_add_pd(_acc, _mm_mul_pd(_a, _b));
 			}
+		};
+#endif // CCKIT_SSE2
+#ifdef CCKIT_AVX
+		template<>
+		struct MatrixSimd<float>
+		{
+			typedef __m256 vector_type;
+			static const size_t WIDTH = 8;
+
+			static vector_type Zero() { return _mm256_setzero_ps(); }
+			static vector_type Broadcast(float _val) { return _mm256_set1_ps(_val); }
+			static vector_type Load(const float* _ptr) { return _mm256_loadu_ps(_ptr); }
+			static void Store(float* _ptr, vector_type _v) { _mm256_storeu_ps(_ptr, _v); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm256_add_ps(_acc, _mm256_mul_ps(_a, _b));
+			}
+		};
+		template<>
+		struct MatrixSimd<double>
+		{
+			typedef __m256d vector_type;
+			static const size_t WIDTH = 4;
+
+			static vector_type Zero() { return _mm256_setzero_pd(); }
+			static vector_type Broadcast(double _val) { return _mm256_set1_pd(_val); }
+			static vector_type Load(const double* _ptr) { return _mm256_loadu_pd(_ptr); }
+			static void Store(double* _ptr, vector_type _v) { _mm256_storeu_pd(_ptr, _v); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm256_add_pd(_acc, _mm256_mul_pd(_a, _b));
+			}
+		};
+#endif // CCKIT_AVX
+
+		// rows of C computed together by one kernel call, and the rows and depth of the tiles of A and B kept in cache
+		const size_t MATRIX_KERNEL_ROWS = 4;
+		const size_t MATRIX_TILE_ROWS = 64;
+		const size_t MATRIX_TILE_DEPTH = 256;
+
+		/*
+		C (+)= A * B for a Rows x (Vectors * WIDTH) block of C, with Rows 1 or 4 and Vectors 1 or 2. The accumulators are
+		named locals rather than an array, so that they stay in registers for the whole depth: every step loads Vectors
+		registers from a row of B and multiplies them by one broadcast element per row of A. A nonzero Depth replaces
+		_depth by a constant, so that the loop over it unrolls for fixed-size matrices.
+		*/
+		template<typename Simd, size_t Rows, size_t Vectors, size_t Depth = 0>
+		struct MatrixKernel
+		{
+			static_assert((Rows == 1 || Rows == 4) && (Vectors == 1 || Vectors == 2), "unsupported kernel shape");
+			typedef typename Simd::vector_type vector_type;
+
+			template<typename T>
+			static void run(const T* _a, size_t _lda, const T* _b, size_t _ldb, T* _c, size_t _ldc, size_t _depth, bool _accumulate) {
+				if (Depth != 0)
+					_depth = Depth;
+				const size_t width = Simd::WIDTH;
+				const T* a0 = _a;
+				const T* a1 = _a + _lda;
+				const T* a2 = _a + 2 * _lda;
+				const T* a3 = _a + 3 * _lda;
+				T* c0 = _c;
+				T* c1 = _c + _ldc;
+				T* c2 = _c + 2 * _ldc;
+				T* c3 = _c + 3 * _ldc;
+
+				vector_type acc00 = Simd::Zero(), acc01 = Simd::Zero(), acc10 = Simd::Zero(), acc11 = Simd::Zero();
+				vector_type acc20 = Simd::Zero(), acc21 = Simd::Zero(), acc30 = Simd::Zero(), acc31 = Simd::Zero();
+				if (_accumulate) {
+					acc00 = Simd::Load(c0);
+					if (Vectors > 1) acc01 = Simd::Load(c0 + width);
+					if (Rows > 1) {
+						acc10 = Simd::Load(c1);
+						acc20 = Simd::Load(c2);
+						acc30 = Simd::Load(c3);
+						if (Vectors > 1) {
+							acc11 = Simd::Load(c1 + width);
+							acc21 = Simd::Load(c2 + width);
+							acc31 = Simd::Load(c3 + width);
+						}
+					}
+				}
+
+				for (size_t k = 0; k < _depth; ++k, _b += _ldb) {
+					vector_type b0 = Simd::Load(_b);
+					vector_type b1 = (Vectors > 1) ? Simd::Load(_b + width) : b0;
+					vector_type a = Simd::Broadcast(a0[k]);
+					acc00 = Simd::MultiplyAdd(acc00, a, b0);
+					if (Vectors > 1) acc01 = Simd::MultiplyAdd(acc01, a, b1);
+					if (Rows > 1) {
+						a = Simd::Broadcast(a1[k]);
+						acc10 = Simd::MultiplyAdd(acc10, a, b0);
+						if (Vectors > 1) acc11 = Simd::MultiplyAdd(acc11, a, b1);
+						a = Simd::Broadcast(a2[k]);
+						acc20 = Simd::MultiplyAdd(acc20, a, b0);
+						if (Vectors > 1) acc21 = Simd::MultiplyAdd(acc21, a, b1);
+						a = Simd::Broadcast(a3[k]);
+						acc30 = Simd::MultiplyAdd(acc30, a, b0);
+						if (Vectors > 1) acc31 = Simd::MultiplyAdd(acc31, a, b1);
+					}
+				}
+
+				Simd::Store(c0, acc00);
+				if (Vectors > 1) Simd::Store(c0 + width, acc01);
+				if (Rows > 1) {
+					Simd::Store(c1, acc10);
+					Simd::Store(c2, acc20);
+					Simd::Store(c3, acc30);
+					if (Vectors > 1) {
+						Simd::Store(c1 + width, acc11);
+						Simd::Store(c2 + width, acc21);
+						Simd::Store(c3 + width, acc31);
+					}
+				}
+			}
+		};
+
+		// one column strip of C over _rows rows, MATRIX_KERNEL_ROWS at a time while the strip of B stays in L1
+		template<typename Simd, size_t Vectors, size_t Depth = 0, typename T>
+		inline void MatrixMultiplyStrip(const T* _a, size_t _lda, const T* _b, size_t _ldb, T* _c, size_t _ldc
+			, size_t _rows, size_t _depth, bool _accumulate)
+		{
+			for (; _rows >= MATRIX_KERNEL_ROWS; _rows -= MATRIX_KERNEL_ROWS, _a += MATRIX_KERNEL_ROWS * _lda, _c += MATRIX_KERNEL_ROWS * _ldc)
+				MatrixKernel<Simd, MATRIX_KERNEL_ROWS, Vectors, Depth>::run(_a, _lda, _b, _ldb, _c, _ldc, _depth, _accumulate);
+			for (; _rows > 0; --_rows, _a += _lda, _c += _ldc)
+				MatrixKernel<Simd, 1, Vectors, Depth>::run(_a, _lda, _b, _ldb, _c, _ldc, _depth, _accumulate);
+		}
+
+		// C = A * B for matrix operands that fit in L1 as they are: the strips of matrix_multiply without the tiling, with
+		// the depth a constant
+		template<size_t Rows, size_t Depth, size_t Cols, typename T>
+		inline void MatrixMultiplyFixed(const T* _a, const T* _b, T* _c)
+		{
+			typedef MatrixSimd<T> simd;
+			typedef MatrixSse<T> sse;
+			typedef MatrixScalar<T> scalar;
+
+			size_t col = 0;
+			for (; col + 2 * simd::WIDTH <= Cols; col += 2 * simd::WIDTH)
+				MatrixMultiplyStrip<simd, 2, Depth>(_a, Depth, _b + col, Cols, _c + col, Cols, Rows, Depth, false);
+			for (; col + simd::WIDTH <= Cols; col += simd::WIDTH)
+				MatrixMultiplyStrip<simd, 1, Depth>(_a, Depth, _b + col, Cols, _c + col, Cols, Rows, Depth, false);
+			for (; col + sse::WIDTH <= Cols; col += sse::WIDTH)
+				MatrixMultiplyStrip<sse, 1, Depth>(_a, Depth, _b + col, Cols, _c + col, Cols, Rows, Depth, false);
+			for (; col < Cols; ++col)
+				MatrixMultiplyStrip<scalar, 1, Depth>(_a, Depth, _b + col, Cols, _c + col, Cols, Rows, Depth, false);
 		}
+	}
+
+	/*
+	C = A * B for row-major operands, where A is _rows x _depth, B is _depth x _cols and C is _rows x _cols, with
+	consecutive rows _lda, _ldb and _ldc elements apart. C must not overlap A or B.
+
+	The depth is split into tiles of MATRIX_TILE_DEPTH and the rows into tiles of MATRIX_TILE_ROWS, so a tile of A stays
+	in L2 while C is swept in strips two registers wide, each strip of the B tile staying in L1 while it meets every row
+	of the A tile. Columns left over past the last full AVX register go through SSE, and then through the scalar kernel.
+	*/
+	template<typename T>
+	void matrix_multiply(const T* _a, size_t _lda, const T* _b, size_t _ldb, T* _c, size_t _ldc
+		, size_t _rows, size_t _cols, size_t _depth);
+	// as matrix_multiply, but C += A * B
+	template<typename T>
+	void matrix_multiply_add(const T* _a, size_t _lda, const T* _b, size_t _ldb, T* _c, size_t _ldc
+		, size_t _rows, size_t _cols, size_t _depth);
+
+	namespace
+	{
+		template<typename T>
+		void MatrixMultiplyTiles(const T* _a, size_t _lda, const T* _b, size_t _ldb, T* _c, size_t _ldc
+			, size_t _rows, size_t _cols, size_t _depth, bool _accumulate)
+		{
+			typedef MatrixSimd<T> simd;
+			typedef MatrixSse<T> sse;
+			typedef MatrixScalar<T> scalar;
+
+			for (size_t k = 0; k < _depth; k += MATRIX_TILE_DEPTH) {
+				size_t depth = (_depth - k < MATRIX_TILE_DEPTH) ? _depth - k : MATRIX_TILE_DEPTH;
+				bool accumulate = _accumulate || (k != 0);
+				const T* b = _b + k * _ldb;
+
+				for (size_t row = 0; row < _rows; row += MATRIX_TILE_ROWS) {
+					size_t rows = (_rows - row < MATRIX_TILE_ROWS) ? _rows - row : MATRIX_TILE_ROWS;
+					const T* a = _a + row * _lda + k;
+					T* c = _c + row * _ldc;
+
+					size_t col = 0;
+					for (; col + 2 * simd::WIDTH <= _cols; col += 2 * simd::WIDTH)
+						MatrixMultiplyStrip<simd, 2>(a, _lda, b + col, _ldb, c + col, _ldc, rows, depth, accumulate);
+					for (; col + simd::WIDTH <= _cols; col += simd::WIDTH)
+						MatrixMultiplyStrip<simd, 1>(a, _lda, b + col, _ldb, c + col, _ldc, rows, depth, accumulate);
+					for (; col + sse::WIDTH <= _cols; col += sse::WIDTH)
+						MatrixMultiplyStrip<sse, 1>(a, _lda, b + col, _ldb, c + col, _ldc, rows, depth, accumulate);
+					for (; col < _cols; ++col)
+						MatrixMultiplyStrip<scalar, 1>(a, _lda, b + col, _ldb, c + col, _ldc, rows, depth, accumulate);
+				}
+			}
+		}
+	}
+
+	template<typename T>
+	inline void matrix_multiply(const T* _a, size_t _lda, const T* _b, size_t _ldb, T* _c, size_t _ldc
+		, size_t _rows, size_t _cols, size_t _depth)
+	{
+		if (_depth == 0) {
+			for (size_t row = 0; row < _rows; ++row)
+				for (size_t col = 0; col < _cols; ++col)
+					_c[row * _ldc + col] = T();
+			return;
+		}
+		MatrixMultiplyTiles(_a, _lda, _b, _ldb, _c, _ldc, _rows, _cols, _depth, false);
+	}
+
+	template<typename T>
+	inline void matrix_multiply_add(const T* _a, size_t _lda, const T* _b, size_t _ldb, T* _c, size_t _ldc
+		, size_t _rows, size_t _cols, size_t _depth)
+	{
+		MatrixMultiplyTiles(_a, _lda, _b, _ldb, _c, _ldc, _rows, _cols, _depth, true);
+	}
+
+	namespace
+	{
+		// _result = _mat0 * _mat1, where _result is neither operand
+		template<int i, int j, int k, typename T>
+		inline void MatrixMultiplyInto(const matrix<i, j, T>& _mat0, const matrix<j, k, T>& _mat1, matrix<i, k, T>& _result)
+		{
+			if (j <= static_cast<int>(MATRIX_TILE_DEPTH) && i <= static_cast<int>(MATRIX_TILE_ROWS))
+				MatrixMultiplyFixed<i, j, k>(&_mat0.mArray[0][0], &_mat1.mArray[0][0], &_result.mArray[0][0]);
+			else
+				cckit::matrix_multiply(&_mat0.mArray[0][0], j, &_mat1.mArray[0][0], k, &_result.mArray[0][0], k, i, k, j);
+		}
+	}
+
+	template<int i, int j, int k, typename T>
+	matrix<i, k, T> multiply(const matrix<i, j, T>& _mat0, const matrix<j, k, T>& _mat1) {
+		matrix<i, k, T> resultMat;
+		MatrixMultiplyInto(_mat0, _mat1, resultMat);
 		return resultMat;
 	}
 
-	template<int Length, typename = cckit::enable_if_t<(Length > 0)> >
-	double determinant(const matrix<Length, Length>& _mat) {
-		double result = 0;
-		for (int col = 0; col < _mat.COL; ++col) 
-			result += _mat.cofactor(0, col) * _mat.at(0, col);
+	namespace
+	{
+		// how an expression holds an operand: matrices by reference, expressions, which are temporaries, by value
+		template<typename Expression>
+		struct MatrixExpressionStorage
+		{
+			typedef const Expression type;
+		};
+		template<int Row, int Col, typename T>
+		struct MatrixExpressionStorage<matrix<Row, Col, T> >
+		{
+			typedef const matrix<Row, Col, T>& type;
+		};
+
+		// an operand of a product as a matrix: a matrix as it is, an expression evaluated once
+		template<typename Expression>
+		class MatrixOperand
+		{
+		public:
+			typedef matrix<Expression::ROW, Expression::COL, typename Expression::value_type> matrix_type;
+			explicit MatrixOperand(const Expression& _expr) : mMatrix(_expr) {}
+			const matrix_type& get() const { return mMatrix; }
+		private:
+			matrix_type mMatrix;
+		};
+		template<int Row, int Col, typename T>
+		class MatrixOperand<matrix<Row, Col, T> >
+		{
+		public:
+			typedef matrix<Row, Col, T> matrix_type;
+			explicit MatrixOperand(const matrix_type& _mat) : mMatrix(_mat) {}
+			const matrix_type& get() const { return mMatrix; }
+		private:
+			const matrix_type& mMatrix;
+		};
+
+		template<typename Left, typename Right>
+		struct MatrixSameShape
+		{
+			static const bool value = Left::ROW == Right::ROW && Left::COL == Right::COL
+				&& is_same<typename Left::value_type, typename Right::value_type>::value;
+		};
+	}
+
+	/*
+	The lazy expressions. An element of a sum, difference, multiple or transpose is computed from the same element, or
+	the mirrored one, of its operands only when it is read, so assigning a whole chain to a matrix runs one fused loop.
+	A product instead is computed by the multiply kernels, straight into the destination when it is assigned directly,
+	or into a temporary of its evaluator when it is part of a larger expression, which is then read like a matrix.
+
+	An expression is ALIAS_SAFE when every element it produces only depends on the same element of the matrices it
+	reads, so that it may overwrite one of them as it goes. That is known at compile time; only assignments of other
+	expressions check references() at run time and go through a temporary when the destination is read.
+	*/
+	template<typename Left, typename Right>
+	class matrix_sum : public matrix_expression<matrix_sum<Left, Right> >
+	{
+		static_assert(MatrixSameShape<Left, Right>::value, "the operands of a sum must have the same shape and type");
+	public:
+		typedef typename Left::value_type value_type;
+		static const int ROW = Left::ROW;
+		static const int COL = Left::COL;
+		static const bool ALIAS_SAFE = Left::ALIAS_SAFE && Right::ALIAS_SAFE;
+
+		matrix_sum(const Left& _left, const Right& _right) : mLeft(_left), mRight(_right) {}
+
+		class evaluator
+		{
+		public:
+			explicit evaluator(const matrix_sum& _expr) : mLeft(_expr.mLeft), mRight(_expr.mRight) {}
+			value_type operator()(int _row, int _col) const { return mLeft(_row, _col) + mRight(_row, _col); }
+		private:
+			typename Left::evaluator mLeft;
+			typename Right::evaluator mRight;
+		};
+		bool references(const void* _pMat) const { return mLeft.references(_pMat) || mRight.references(_pMat); }
+
+	private:
+		typename MatrixExpressionStorage<Left>::type mLeft;
+		typename MatrixExpressionStorage<Right>::type mRight;
+	};
+
+	template<typename Left, typename Right>
+	class matrix_difference : public matrix_expression<matrix_difference<Left, Right> >
+	{
+		static_assert(MatrixSameShape<Left, Right>::value, "the operands of a difference must have the same shape and type");
+	public:
+		typedef typename Left::value_type value_type;
+		static const int ROW = Left::ROW;
+		static const int COL = Left::COL;
+		static const bool ALIAS_SAFE = Left::ALIAS_SAFE && Right::ALIAS_SAFE;
+
+		matrix_difference(const Left& _left, const Right& _right) : mLeft(_left), mRight(_right) {}
+
+		class evaluator
+		{
+		public:
+			explicit evaluator(const matrix_difference& _expr) : mLeft(_expr.mLeft), mRight(_expr.mRight) {}
+			value_type operator()(int _row, int _col) const { return mLeft(_row, _col) - mRight(_row, _col); }
+		private:
+			typename Left::evaluator mLeft;
+			typename Right::evaluator mRight;
+		};
+		bool references(const void* _pMat) const { return mLeft.references(_pMat) || mRight.references(_pMat); }
+
+	private:
+		typename MatrixExpressionStorage<Left>::type mLeft;
+		typename MatrixExpressionStorage<Right>::type mRight;
+	};
+
+	template<typename Expression>
+	class matrix_multiple : public matrix_expression<matrix_multiple<Expression> >
+	{
+	public:
+		typedef typename Expression::value_type value_type;
+		static const int ROW = Expression::ROW;
+		static const int COL = Expression::COL;
+		static const bool ALIAS_SAFE = Expression::ALIAS_SAFE;
+
+		matrix_multiple(const Expression& _expr, value_type _scalar) : mExpr(_expr), mScalar(_scalar) {}
+
+		class evaluator
+		{
+		public:
+			explicit evaluator(const matrix_multiple& _expr) : mExpr(_expr.mExpr), mScalar(_expr.mScalar) {}
+			value_type operator()(int _row, int _col) const { return mExpr(_row, _col) * mScalar; }
+		private:
+			typename Expression::evaluator mExpr;
+			value_type mScalar;
+		};
+		bool references(const void* _pMat) const { return mExpr.references(_pMat); }
+
+	private:
+		typename MatrixExpressionStorage<Expression>::type mExpr;
+		value_type mScalar;
+	};
+
+	template<typename Expression>
+	class matrix_transpose : public matrix_expression<matrix_transpose<Expression> >
+	{
+	public:
+		typedef typename Expression::value_type value_type;
+		static const int ROW = Expression::COL;
+		static const int COL = Expression::ROW;
+		// element (row, col) reads (col, row), which an in-place assignment has already overwritten
+		static const bool ALIAS_SAFE = false;
+
+		explicit matrix_transpose(const Expression& _expr) : mExpr(_expr) {}
+
+		class evaluator
+		{
+		public:
+			explicit evaluator(const matrix_transpose& _expr) : mExpr(_expr.mExpr) {}
+			value_type operator()(int _row, int _col) const { return mExpr(_col, _row); }
+		private:
+			typename Expression::evaluator mExpr;
+		};
+		bool references(const void* _pMat) const { return mExpr.references(_pMat); }
+
+	private:
+		typename MatrixExpressionStorage<Expression>::type mExpr;
+	};
+
+	template<typename Left, typename Right>
+	class matrix_product : public matrix_expression<matrix_product<Left, Right> >
+	{
+		static_assert(Left::COL == Right::ROW, "the columns of the left operand of a product must match the rows of the right one");
+		static_assert(is_same<typename Left::value_type, typename Right::value_type>::value, "the operands of a product must have the same type");
+	public:
+		typedef typename Left::value_type value_type;
+		typedef matrix<Left::ROW, Right::COL, value_type> matrix_type;
+		static const int ROW = Left::ROW;
+		static const int COL = Right::COL;
+		// as part of a larger expression, a product is read from a temporary computed before anything is written
+		static const bool ALIAS_SAFE = true;
+
+		matrix_product(const Left& _left, const Right& _right) : mLeft(_left), mRight(_right) {}
+
+		class evaluator
+		{
+		public:
+			explicit evaluator(const matrix_product& _expr) : mProduct() { _expr.EvaluateTo(mProduct); }
+			value_type operator()(int _row, int _col) const { return mProduct.mArray[_row][_col]; }
+		private:
+			matrix_type mProduct;
+		};
+		bool references(const void* _pMat) const { return mLeft.references(_pMat) || mRight.references(_pMat); }
+
+		// _result = *this, where _result is not referenced
+		void EvaluateTo(matrix_type& _result) const {
+			MatrixOperand<Left> left(mLeft);
+			MatrixOperand<Right> right(mRight);
+			MatrixMultiplyInto(left.get(), right.get(), _result);
+		}
+
+	private:
+		typename MatrixExpressionStorage<Left>::type mLeft;
+		typename MatrixExpressionStorage<Right>::type mRight;
+	};
+
+	template<typename Left, typename Right>
+	inline matrix_sum<Left, Right> operator+(const matrix_expression<Left>& _left, const matrix_expression<Right>& _right) {
+		return matrix_sum<Left, Right>(_left.derived(), _right.derived());
+	}
+	template<typename Left, typename Right>
+	inline matrix_difference<Left, Right> operator-(const matrix_expression<Left>& _left, const matrix_expression<Right>& _right) {
+		return matrix_difference<Left, Right>(_left.derived(), _right.derived());
+	}
+	template<typename Expression>
+	inline matrix_multiple<Expression> operator*(const matrix_expression<Expression>& _expr, typename Expression::value_type _scalar) {
+		return matrix_multiple<Expression>(_expr.derived(), _scalar);
+	}
+	template<typename Expression>
+	inline matrix_multiple<Expression> operator*(typename Expression::value_type _scalar, const matrix_expression<Expression>& _expr) {
+		return matrix_multiple<Expression>(_expr.derived(), _scalar);
+	}
+	template<typename Left, typename Right>
+	inline matrix_product<Left, Right> operator*(const matrix_expression<Left>& _left, const matrix_expression<Right>& _right) {
+		return matrix_product<Left, Right>(_left.derived(), _right.derived());
+	}
+	template<typename Expression>
+	inline matrix_transpose<Expression> transpose(const matrix_expression<Expression>& _expr) {
+		return matrix_transpose<Expression>(_expr.derived());
+	}
+
+	namespace
+	{
+		template<int Row, int Col, typename T, typename Expression>
+		inline void MatrixAssignElements(matrix<Row, Col, T>& _dst, const Expression& _expr)
+		{
+			typename Expression::evaluator eval(_expr);
+			for (int row = 0; row < Row; ++row)
+				for (int col = 0; col < Col; ++col)
+					_dst.mArray[row][col] = eval(row, col);
+		}
+
+		// element by element straight into the destination
+		template<int Row, int Col, typename T, typename Expression>
+		inline void MatrixAssign(matrix<Row, Col, T>& _dst, const Expression& _expr, true_type)
+		{
+			MatrixAssignElements(_dst, _expr);
+		}
+
+		// the same unless the destination is read, in which case the result goes to a temporary first
+		template<int Row, int Col, typename T, typename Expression>
+		inline void MatrixAssign(matrix<Row, Col, T>& _dst, const Expression& _expr, false_type)
+		{
+			if (!_expr.references(&_dst)) {
+				MatrixAssignElements(_dst, _expr);
+				return;
+			}
+			matrix<Row, Col, T> temp;
+			MatrixAssignElements(temp, _expr);
+			_dst = temp;
+		}
+
+		// a product goes straight into the destination unless the destination is one of its operands
+		template<int Row, int Col, typename T, typename Left, typename Right>
+		inline void MatrixAssign(matrix<Row, Col, T>& _dst, const matrix_product<Left, Right>& _expr, true_type)
+		{
+			if (!_expr.references(&_dst)) {
+				_expr.EvaluateTo(_dst);
+				return;
+			}
+			matrix<Row, Col, T> temp;
+			_expr.EvaluateTo(temp);
+			_dst = temp;
+		}
+	}
+
+	template<int Row, int Col, typename T>
+	template<typename Expression>
+	inline matrix<Row, Col, T>::matrix(const matrix_expression<Expression>& _expr)
+	{
+		static_assert(MatrixSameShape<matrix<Row, Col, T>, Expression>::value, "an expression must have the shape and type of the matrix it is assigned to");
+		// a matrix under construction cannot be read by the expression
+		MatrixAssign(*this, _expr.derived(), true_type());
+	}
+
+	template<int Row, int Col, typename T>
+	template<typename Expression>
+	inline matrix<Row, Col, T>& matrix<Row, Col, T>::operator=(const matrix_expression<Expression>& _expr)
+	{
+		static_assert(MatrixSameShape<matrix<Row, Col, T>, Expression>::value, "an expression must have the shape and type of the matrix it is assigned to");
+		MatrixAssign(*this, _expr.derived(), integral_constant<bool, Expression::ALIAS_SAFE>());
+		return *this;
+	}
+
+	template<int Length, typename T, typename = cckit::enable_if_t<(Length > 0)> >
+	inline T determinant(const matrix<Length, Length, T>& _mat) {
+		return lu_decomposition<Length, T>(_mat).determinant();
+	}
+
+	const int MATRIX_UNROLL_LENGTH = 8;
+
+	/*
+	The factorization P * A = L * U of a square matrix by Gaussian elimination with partial pivoting, computed once in
+	O(Length^3) and then reused: determinant() is the product of the pivots, and solve() and inverse() are a forward and a
+	back substitution per right-hand side column. L (with its unit diagonal left implicit) and U share one matrix.
+
+	A matrix of an integral type is factored in double, since its pivots are fractions in general. determinant() rounds
+	the product back to the nearest integer, which it is; solve() and inverse() return their fractions as doubles.
+
+	Up to MATRIX_UNROLL_LENGTH the elimination steps are instantiated one per column, so that every loop bound is a
+	constant and small matrices compile to straight-line code; larger ones run the same steps in an ordinary loop.
+	*/
+	template<int Length, typename T>
+	class lu_decomposition
+	{
+		typedef lu_decomposition<Length, T> this_type;
+	public:
+		typedef matrix<Length, Length, T> matrix_type;
+		typedef MatrixFactor<T> factor_type;
+		typedef matrix<Length, Length, factor_type> factor_matrix_type;
+
+		explicit lu_decomposition(const matrix_type& _mat);
+
+		// true if some column had no nonzero pivot; determinant() is then 0, and solve() and inverse() are meaningless
+		bool singular() const { return mSingular; }
+		T determinant() const;
+		// the X with A * X = _rhs, for any number of right-hand side columns
+		template<int Count>
+		matrix<Length, Count, factor_type> solve(const matrix<Length, Count, T>& _rhs) const;
+		factor_matrix_type inverse() const;
+
+		const factor_matrix_type& lu() const { return mLU; }
+		// row i of P * A is row pivot(i) of A
+		int pivot(int _row) const { return mPivots[_row]; }
+
+	private:
+		void Factor(true_type);
+		void Factor(false_type);
+		// the step for column Col, with every loop bound a compile-time constant
+		template<int Col>
+		void Eliminate() { Eliminate(integral_constant<int, Col>()); }
+		// _col is an int, or an integral_constant<int, Col> from the overload above
+		template<typename Column>
+		void Eliminate(Column _col);
+		static T Round(factor_type _value, true_type) { return static_cast<T>(std::floor(_value + factor_type(0.5))); }
+		static T Round(factor_type _value, false_type) { return _value; }
+
+		template<int Col, bool Done = (Col == Length)>
+		struct UnrolledStep
+		{
+			static void run(this_type& _lu) {
+				_lu.template Eliminate<Col>();
+				UnrolledStep<Col + 1>::run(_lu);
+			}
+		};
+		template<int Col>
+		struct UnrolledStep<Col, true>
+		{
+			static void run(this_type&) {}
+		};
+
+	private:
+		factor_matrix_type mLU;
+		int mPivots[Length];
+		bool mOddPermutation;
+		bool mSingular;
+	};
+}
+
+namespace cckit
+{
+	template<int Length, typename T>
+	inline lu_decomposition<Length, T>::lu_decomposition(const matrix_type& _mat)
+		: mLU(), mOddPermutation(false), mSingular(false)
+	{
+		for (int row = 0; row < Length; ++row) {
+			for (int col = 0; col < Length; ++col)
+				mLU.mArray[row][col] = static_cast<factor_type>(_mat.mArray[row][col]);
+			mPivots[row] = row;
+		}
+		Factor(integral_constant<bool, (Length <= MATRIX_UNROLL_LENGTH)>());
+	}
+
+	template<int Length, typename T>
+	inline void lu_decomposition<Length, T>::Factor(true_type)
+	{
+		UnrolledStep<0>::run(*this);
+	}
+
+	template<int Length, typename T>
+	inline void lu_decomposition<Length, T>::Factor(false_type)
+	{
+		for (int col = 0; col < Length; ++col)
+			Eliminate(col);
+	}
+
+	// moves the largest remaining entry of column _col onto the diagonal and clears the column below it
+	template<int Length, typename T>
+	template<typename Column>
+	inline void lu_decomposition<Length, T>::Eliminate(Column _col)
+	{
+		factor_type (&a)[Length][Length] = mLU.mArray;
+
+		int pivotRow = _col;
+		factor_type largestAbs = std::abs(a[_col][_col]);
+		for (int row = _col + 1; row < Length; ++row) {
+			factor_type absVal = std::abs(a[row][_col]);
+			if (largestAbs < absVal) {
+				largestAbs = absVal;
+				pivotRow = row;
+			}
+		}
+		if (largestAbs == 0) {
+			mSingular = true;
+			return;
+		}
+		if (pivotRow != _col) {
+			for (int col = 0; col < Length; ++col) {
+				factor_type temp = a[pivotRow][col];
+				a[pivotRow][col] = a[_col][col];
+				a[_col][col] = temp;
+			}
+			int temp = mPivots[pivotRow];
+			mPivots[pivotRow] = mPivots[_col];
+			mPivots[_col] = temp;
+			mOddPermutation = !mOddPermutation;
+		}
+
+		factor_type reciprocal = 1 / a[_col][_col];
+		for (int row = _col + 1; row < Length; ++row) {
+			factor_type factor = (a[row][_col] *= reciprocal);
+			for (int col = _col + 1; col < Length; ++col)
+				a[row][col] -= factor * a[_col][col];
+		}
+	}
+
+	template<int Length, typename T>
+	inline T lu_decomposition<Length, T>::determinant() const
+	{
+		if (mSingular) return 0;
+		factor_type result = mOddPermutation ? -1 : 1;
+		for (int i = 0; i < Length; ++i)
+			result *= mLU.mArray[i][i];
+		return Round(result, is_integral<T>());
+	}
+
+	template<int Length, typename T>
+	template<int Count>
+	inline matrix<Length, Count, typename lu_decomposition<Length, T>::factor_type>
+		lu_decomposition<Length, T>::solve(const matrix<Length, Count, T>& _rhs) const
+	{
+		const factor_type (&a)[Length][Length] = mLU.mArray;
+		matrix<Length, Count, factor_type> result;
+
+		// L * Y = P * B, row by row so that every inner loop runs along a row of the result
+		for (int row = 0; row < Length; ++row) {
+			for (int col = 0; col < Count; ++col)
+				result.mArray[row][col] = static_cast<factor_type>(_rhs.mArray[mPivots[row]][col]);
+			for (int k = 0; k < row; ++k) {
+				factor_type factor = a[row][k];
+				for (int col = 0; col < Count; ++col)
+					result.mArray[row][col] -= factor * result.mArray[k][col];
+			}
+		}
+		// U * X = Y
+		for (int row = Length - 1; row >= 0; --row) {
+			for (int k = row + 1; k < Length; ++k) {
+				factor_type factor = a[row][k];
+				for (int col = 0; col < Count; ++col)
+					result.mArray[row][col] -= factor * result.mArray[k][col];
+			}
+			factor_type reciprocal = 1 / a[row][row];
+			for (int col = 0; col < Count; ++col)
+				result.mArray[row][col] *= reciprocal;
+		}
 		return result;
 	}
-	double determinant(const matrix<1, 1>& _mat) {
-		return _mat.at(0, 0);
+
+	template<int Length, typename T>
+	inline typename lu_decomposition<Length, T>::factor_matrix_type lu_decomposition<Length, T>::inverse() const
+	{
+		matrix_type identity;
+		for (int row = 0; row < Length; ++row)
+			for (int col = 0; col < Length; ++col)
+				identity.mArray[row][col] = ((row != col) ? 0 : 1);
+		return solve(identity);
 	}
 }
 
@@ -2,6 +2,8 @@
 #define CCKIT_PRIORITY_QUEUE_H
 
 #include "internal/binary_heap.h"
+#include "internal/pairing_heap.h"
+#include "internal/radix_heap.h"
 
 namespace cckit
 {
@@ -24,13 +26,17 @@ namespace cckit
 
 	"Compare"
 	A Compare type providing a strict weak ordering.
+
+	"DataStructure"
+	The heap implementation: binary_heap (default), quaternary_heap or octonary_heap for array-backed d-ary heaps,
+	pairing_heap for constant time push and meld(), or radix_heap for monotone integral keys.
 	*/
 	template<typename T, typename Container = cckit::deque<T>, typename Compare = cckit::less<T>
 		, template<typename, typename, typename> class DataStructure = cckit::binary_heap>
 	class priority_queue : public DataStructure<T, Container, Compare>
 	{
 	private:
-		typedef priority_queue<T, Container, Compare> this_type;
+		typedef priority_queue<T, Container, Compare, DataStructure> this_type;
 		typedef DataStructure<T, Container, Compare> base_type;
 	public:
 		typedef Container container_type;
@@ -21,6 +21,36 @@ namespace cckit
 
 		return _min + rand() % (_max - _min);
 	}
+
+	// xorshift64* (Vigna): a handful of cycles per number and no shared state, unlike rand()
+	class xorshift_random
+	{
+	public:
+		explicit xorshift_random(unsigned long long _seed = static_cast<unsigned long long>(time(0)))
+			: mState(_seed ? _seed : 0x9e3779b97f4a7c15ull)
+		{}
+
+		unsigned int operator()()
+		{
+			mState ^= mState >> 12;
+			mState ^= mState << 25;
+			mState ^= mState >> 27;
+			return static_cast<unsigned int>((mState * 0x2545f4914f6cdd1dull) >> 32);
+		}
+
+		// uniform in [_min, _max) like cckit::rand_int, by scaling instead of a biased modulo
+		int rand_int(int _min, int _max)
+		{
+#ifdef CCKIT_DEBUG
+			assert(_min < _max);
+#endif 
+			unsigned long long range = static_cast<unsigned int>(_max - _min);
+			return _min + static_cast<int>((range * (*this)()) >> 32);
+		}
+
+	private:
+		unsigned long long mState;
+	};
 }// namespace cckit
 
 #endif // !CCKIT_RANDOM_H
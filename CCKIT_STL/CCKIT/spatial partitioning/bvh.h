@@ -1,40 +1,968 @@
 #ifndef CCKIT_BVH_H
 #define CCKIT_BVH_H
 
+#include "../internal/config.h"
+#include "../internal/bit_scan.h"
+#include "../thread_pool.h"
 #include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <atomic>
+#include <type_traits>
 
 namespace cckit
 {
-	template<typename Obj>
-	float Extent(const Obj& _obj) {
-		return -1.0f;
-	}
-
+	/*
+	An axis aligned bounding box. A default constructed box is empty, its lower corner above its upper one, so that
+	expanding it by a box or a point yields exactly that box or point.
+	*/
 	template<typename T, size_t Dim>
 	class AABB
 	{
 	public:
-		AABB(T _min[Dim], T _max[Dim]);
+		typedef T value_type;
+	private:
+		typedef AABB<T, Dim> this_type;
+	public:
+		AABB();
+		AABB(const value_type _lower[Dim], const value_type _upper[Dim]);
+
+		const value_type* lower() const { return mLower; }
+		const value_type* upper() const { return mUpper; }
+		bool empty() const;
+		value_type center(size_t _axis) const { return (mLower[_axis] + mUpper[_axis]) / 2; }
+
+		void expand(const this_type& _box);
+		void expand(const value_type _pt[Dim]);
+		bool overlaps(const this_type& _box) const;
+		bool contains(const value_type _pt[Dim]) const;
+		// the area of one face per axis summed up, i.e. half the surface area in 3D and half the perimeter in 2D
+		value_type half_area() const;
+		// 0 for points inside the box
+		value_type distance_sqr(const value_type _pt[Dim]) const;
+
 	private:
-		T mMin[Dim];
-		T mMax[Dim];
+		value_type mLower[Dim];
+		value_type mUpper[Dim];
 	};
+
 	template<typename T, size_t Dim>
-	AABB<T, Dim>::AABB(T _min[Dim], T _max[Dim]) {
-		for (size_t i = 0; i < Dim; ++i) {
-			mMin[i] = _min[i];
-			mMax[i] = _max[i];
-		}
-	}
+	class bvh;
 
-	template<typename Obj>
-	class BvhNode
+	/*
+	A node of a bvh. The nodes are stored by value in depth first order, so the left child of an inner node is the node
+	right after it and only the right one is referred to by index; a leaf refers to a run of objects instead.
+	*/
+	template<typename T, size_t Dim>
+	class bvh_node
 	{
+	public:
+		typedef AABB<T, Dim> box_type;
+	private:
+		typedef bvh_node<T, Dim> this_type;
+	public:
+		bool leaf() const { return mCount != 0; }
+		const box_type& box() const { return mBox; }
+	private:
+		box_type mBox;
+		uint32_t mOffset;// the right child, or the first object of a leaf
+		uint16_t mCount;// the number of objects of a leaf, 0 for an inner node
+		uint16_t mAxis;// the axis an inner node was split along
+
+		friend class bvh<T, Dim>;
+	};
+
+	/*
+	A bounding volume hierarchy over objects given by their boxes, which queries report by their index in the array the
+	hierarchy was built from.
+
+	build() splits every node where the surface area heuristic estimates the cheapest queries, evaluating BVH_BIN_COUNT
+	candidate planes per axis by binning the centers of the objects rather than sorting them. Queries walk the nodes
+	with a short fixed stack: raycast() visits the near child of every node first and shrinks the ray as it hits
+	objects, nearest() descends into the closer child first and skips every node farther away than the best object so
+	far, and overlap() reports every object whose box overlaps a given one. refit() updates the boxes of moving objects
+	without changing the hierarchy, which stays correct but slowly degrades as the objects move farther.
+
+	build_linear() is the fast alternative for objects that move too much to refit, at the price of somewhat slower
+	queries. It sorts the objects by the Morton code of their centers, so that the hierarchy follows from where the codes
+	of neighboring objects first differ, and every step of that runs in parallel on a thread_pool.
+	*/
+	template<typename T, size_t Dim>
+	class bvh
+	{
+		static_assert(std::is_floating_point<T>::value, "a bvh needs floating point coordinates");
+	public:
+		typedef T value_type;
+		typedef AABB<T, Dim> box_type;
+		typedef bvh_node<T, Dim> node_type;
+	private:
+		typedef bvh<T, Dim> this_type;
+	public:
+		static const size_t DIM = Dim;
+		static const size_t LEAF_CAPACITY = 4;
+		static const uint32_t npos = ~uint32_t(0);
+
+		bvh();
+
+		void build(const box_type* _boxes, size_t _count);
+		void build_linear(const box_type* _boxes, size_t _count);
+		void build_linear(const box_type* _boxes, size_t _count, thread_pool& _pool);
+		// takes the new boxes of the objects build() was given, in the same order
+		void refit(const box_type* _boxes);
+		void clear();
+
+		size_t size() const { return mIndices.size(); }
+		bool empty() const { return mIndices.empty(); }
+		const box_type& bounds() const { return mNodes.front().box(); }
+
+		// replaces the contents of _out with the index of every object whose box overlaps _box and returns how many there are
+		size_t overlap(const box_type& _box, std::vector<uint32_t>& _out) const;
+		/*
+		Finds the first object along the ray _origin + t * _direction for t in [0, _tMax], returns its index and sets
+		_tMax to its t, or returns npos if there is none.
+		"_intersect"
+		_intersect(index, tMax) intersects the ray with an object whose box the ray enters before tMax; if it hits the
+		object before tMax, it sets tMax to where and returns true. Without it the boxes themselves are hit.
+		*/
+		uint32_t raycast(const value_type _origin[Dim], const value_type _direction[Dim], value_type& _tMax) const;
+		template<typename Intersect>
+		uint32_t raycast(const value_type _origin[Dim], const value_type _direction[Dim], value_type& _tMax, Intersect _intersect) const;
+		/*
+		Finds the object closest to _pt, returns its index and sets _distSqr to its squared distance, or returns npos if
+		the hierarchy is empty.
+		"_distance"
+		_distance(index, pt) returns the squared distance from pt to an object, which is only asked about objects whose box
+		is closer than the best one so far. Without it the distance to the boxes themselves is taken.
+		*/
+		uint32_t nearest(const value_type _pt[Dim], value_type& _distSqr) const;
+		template<typename Distance>
+		uint32_t nearest(const value_type _pt[Dim], value_type& _distSqr, Distance _distance) const;
+
 	private:
-		bool mLeaf;
-		AABB* mpBox;
-		//std::vector
+		// an object while building, moved around with its box so that every pass over a node reads memory in order
+		struct BuildRef
+		{
+			box_type mBox;
+			value_type mCenter[Dim];
+			uint32_t mIndex;
+		};
+		struct Bin
+		{
+			box_type mBox;
+			uint32_t mCount;
+		};
+
+		uint32_t Build(BuildRef* _refs, uint32_t _first, uint32_t _last, uint32_t _depth);
+		uint32_t MakeLeaf(uint32_t _node, const box_type& _bounds, uint32_t _first, uint32_t _last);
+		void BuildLinear(const box_type* _boxes, size_t _count, thread_pool* _pPool);
+		void SortByMortonCode(const box_type* _boxes, size_t _count, thread_pool* _pPool);
+		void LinkLinearNode(uint32_t _node);
+		void FitLinearNodes(uint32_t _node);
+		size_t EmitLinearNode(uint32_t _ref, size_t _pos);
+		void EmitLinearSubtree(uint32_t _ref, size_t _pos);
+		// the slot of the last object hit; _hit(slot, tEntry, tMax) is _intersect for the object in that slot of mIndices,
+		// called only once the ray is known to enter its box at tEntry, before tMax
+		template<typename Hit>
+		uint32_t Raycast(const value_type* _origin, const value_type* _direction, value_type& _tMax, Hit _hit) const;
+		template<typename Distance>
+		uint32_t Nearest(const value_type* _pt, value_type& _distSqr, Distance _distance) const;
+
+	private:
+		std::vector<node_type> mNodes;// the root is node 0
+		std::vector<uint32_t> mIndices;// the objects in the order the leaves refer to them
+		std::vector<box_type> mBoxes;// the box of every object, in the same order
+
+		/*
+		A node of the binary radix tree build_linear() derives from the sorted codes before laying it out as nodes. Its n - 1
+		inner nodes are numbered so that node i has an end of its range of objects at i, and a reference to a child is
+		either an inner node or n - 1 plus an object.
+		*/
+		struct LinearNode
+		{
+			box_type mBox;
+			uint32_t mChildren[2];
+			uint32_t mFirst;
+			uint32_t mLast;
+			uint32_t mSize;// how many nodes its subtree is laid out as
+		};
+		// everything build_linear() works in, kept between builds so that rebuilding every frame does not allocate
+		struct LinearScratch
+		{
+			LinearScratch() {}
+			// a copy starts out empty, as there is nothing in here worth copying
+			LinearScratch(const LinearScratch&) {}
+			LinearScratch& operator=(const LinearScratch&) { return *this; }
+
+			std::vector<uint32_t> mCodes;
+			std::vector<uint32_t> mSortBuffer[2];
+			std::vector<box_type> mChunkBounds;
+			std::vector<uint32_t> mRadixCounts;
+			std::vector<LinearNode> mNodes;
+			std::vector<uint32_t> mParents;// of every inner node, then of every object
+			std::vector<std::atomic<uint32_t> > mArrivals;// only ever replaced by a larger one, atomics cannot be moved
+			std::vector<std::pair<uint32_t, size_t> > mFrontier[2];
+		};
+		LinearScratch mLinear;
 	};
 }
 
-#endif // !CCKIT_BVH_H
\ No newline at end of file
+namespace cckit
+{
+	namespace
+	{
+		// candidate splitting planes per axis are the boundaries between this many bins
+		const size_t BVH_BIN_COUNT = 16;
+		// the cost of visiting an inner node relative to intersecting an object
+		const double BVH_TRAVERSAL_COST = 4.0;
+		// nodes this deep are split at their median instead, so that no tree is deeper than BVH_STACK_SIZE. A linear bvh
+		// stays within it as well: each level takes one of the 32 bits of a code or of an index among equal codes
+		const uint32_t BVH_SAH_DEPTH = 32;
+		const size_t BVH_STACK_SIZE = 64;
+		// the number of objects or nodes of a linear build a thread claims at once
+		const size_t BVH_LINEAR_GRAIN = 4096;
+
+		// spreads the low BITS bits of a cell coordinate Dim bits apart, so that the codes of all axes can be interleaved
+		template<size_t Dim>
+		struct BvhMorton
+		{
+			// at most 31, so that the largest cell still fits in 32 bits once its float scale has rounded up
+			static const uint32_t BITS = (Dim == 1) ? 31 : (Dim < 32) ? 32 / Dim : 1;
+			static uint32_t Spread(uint32_t _cell) {
+				uint32_t code = 0;
+				for (uint32_t bit = 0; bit < BITS; ++bit)
+					code |= ((_cell >> bit) & 1) << (bit * Dim);
+				return code;
+			}
+		};
+		template<>
+		struct BvhMorton<2>
+		{
+			static const uint32_t BITS = 16;
+			static uint32_t Spread(uint32_t _cell) {
+				_cell = (_cell | (_cell << 8)) & 0x00FF00FFu;
+				_cell = (_cell | (_cell << 4)) & 0x0F0F0F0Fu;
+				_cell = (_cell | (_cell << 2)) & 0x33333333u;
+				return (_cell | (_cell << 1)) & 0x55555555u;
+			}
+		};
+		template<>
+		struct BvhMorton<3>
+		{
+			static const uint32_t BITS = 10;
+			static uint32_t Spread(uint32_t _cell) {
+				_cell = (_cell | (_cell << 16)) & 0x030000FFu;
+				_cell = (_cell | (_cell << 8)) & 0x0300F00Fu;
+				_cell = (_cell | (_cell << 4)) & 0x030C30C3u;
+				return (_cell | (_cell << 2)) & 0x09249249u;
+			}
+		};
+
+		// the entry t of the ray into _box if it enters before _tMax; NaN from a zero direction component is ignored
+		template<typename T, size_t Dim>
+		inline bool BvhRayEntry(const AABB<T, Dim>& _box, const T* _origin, const T* _invDirection, const bool* _negative
+			, T _tMax, T& _tEntry)
+		{
+			T tNear = 0, tFar = _tMax;
+			for (size_t i = 0; i < Dim; ++i) {
+				T t0 = ((_negative[i] ? _box.upper()[i] : _box.lower()[i]) - _origin[i]) * _invDirection[i];
+				T t1 = ((_negative[i] ? _box.lower()[i] : _box.upper()[i]) - _origin[i]) * _invDirection[i];
+				if (t0 > tNear) tNear = t0;
+				if (t1 < tFar) tFar = t1;
+			}
+			_tEntry = tNear;
+			return tNear <= tFar;
+		}
+	}
+
+	template<typename T, size_t Dim>
+	AABB<T, Dim>::AABB() {
+		for (size_t i = 0; i < Dim; ++i) {
+			mLower[i] = std::numeric_limits<value_type>::max();
+			mUpper[i] = std::numeric_limits<value_type>::lowest();
+		}
+	}
+
+	template<typename T, size_t Dim>
+	AABB<T, Dim>::AABB(const value_type _lower[Dim], const value_type _upper[Dim]) {
+		for (size_t i = 0; i < Dim; ++i) {
+			mLower[i] = _lower[i];
+			mUpper[i] = _upper[i];
+		}
+	}
+
+	template<typename T, size_t Dim>
+	bool AABB<T, Dim>::empty() const {
+		for (size_t i = 0; i < Dim; ++i)
+			if (mUpper[i] < mLower[i])
+				return true;
+		return false;
+	}
+
+	// minima and maxima rather than conditional stores, so that building does not stall on unpredictable branches
+	template<typename T, size_t Dim>
+	void AABB<T, Dim>::expand(const this_type& _box) {
+		for (size_t i = 0; i < Dim; ++i) {
+			mLower[i] = (_box.mLower[i] < mLower[i]) ? _box.mLower[i] : mLower[i];
+			mUpper[i] = (mUpper[i] < _box.mUpper[i]) ? _box.mUpper[i] : mUpper[i];
+		}
+	}
+
+	template<typename T, size_t Dim>
+	void AABB<T, Dim>::expand(const value_type _pt[Dim]) {
+		for (size_t i = 0; i < Dim; ++i) {
+			mLower[i] = (_pt[i] < mLower[i]) ? _pt[i] : mLower[i];
+			mUpper[i] = (mUpper[i] < _pt[i]) ? _pt[i] : mUpper[i];
+		}
+	}
+
+	template<typename T, size_t Dim>
+	bool AABB<T, Dim>::overlaps(const this_type& _box) const {
+		for (size_t i = 0; i < Dim; ++i)
+			if (_box.mUpper[i] < mLower[i] || mUpper[i] < _box.mLower[i])
+				return false;
+		return true;
+	}
+
+	template<typename T, size_t Dim>
+	bool AABB<T, Dim>::contains(const value_type _pt[Dim]) const {
+		for (size_t i = 0; i < Dim; ++i)
+			if (_pt[i] < mLower[i] || mUpper[i] < _pt[i])
+				return false;
+		return true;
+	}
+
+	template<typename T, size_t Dim>
+	typename AABB<T, Dim>::value_type AABB<T, Dim>::half_area() const {
+		value_type area = 0;
+		for (size_t i = 0; i < Dim; ++i) {
+			value_type face = 1;
+			for (size_t j = 0; j < Dim; ++j)
+				if (j != i)
+					face *= mUpper[j] - mLower[j];
+			area += face;
+		}
+		return area;
+	}
+
+	template<typename T, size_t Dim>
+	typename AABB<T, Dim>::value_type AABB<T, Dim>::distance_sqr(const value_type _pt[Dim]) const {
+		value_type distSqr = 0;
+		for (size_t i = 0; i < Dim; ++i) {
+			// at most one of them is positive
+			value_type below = mLower[i] - _pt[i], above = _pt[i] - mUpper[i];
+			value_type diff = (below < above) ? above : below;
+			diff = (diff < 0) ? 0 : diff;
+			distSqr += diff * diff;
+		}
+		return distSqr;
+	}
+
+	template<typename T, size_t Dim>
+	const uint32_t bvh<T, Dim>::npos;
+
+	template<typename T, size_t Dim>
+	bvh<T, Dim>::bvh()
+		: mNodes(), mIndices(), mBoxes(), mLinear() {
+
+	}
+
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::build(const box_type* _boxes, size_t _count) {
+		assert((_count < npos));
+		clear();
+		if (_count == 0) return;
+
+		std::vector<BuildRef> refs(_count);
+		for (size_t index = 0; index < _count; ++index) {
+			BuildRef& ref = refs[index];
+			ref.mBox = _boxes[index];
+			for (size_t i = 0; i < Dim; ++i)
+				ref.mCenter[i] = ref.mBox.center(i);
+			ref.mIndex = static_cast<uint32_t>(index);
+		}
+		mNodes.reserve(2 * _count);
+		Build(refs.data(), 0, static_cast<uint32_t>(_count), 0);
+
+		mIndices.resize(_count);
+		mBoxes.resize(_count);
+		for (size_t slot = 0; slot < _count; ++slot) {
+			mIndices[slot] = refs[slot].mIndex;
+			mBoxes[slot] = refs[slot].mBox;
+		}
+	}
+
+	// children follow their parent in depth first order, so walking the nodes backwards updates them before it
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::refit(const box_type* _boxes) {
+		for (size_t slot = 0; slot < mBoxes.size(); ++slot)
+			mBoxes[slot] = _boxes[mIndices[slot]];
+		for (size_t current = mNodes.size(); current-- > 0;) {
+			node_type& node = mNodes[current];
+			node.mBox = box_type();
+			if (node.leaf()) {
+				for (uint32_t slot = node.mOffset; slot < node.mOffset + node.mCount; ++slot)
+					node.mBox.expand(mBoxes[slot]);
+			}
+			else {
+				node.mBox.expand(mNodes[current + 1].mBox);
+				node.mBox.expand(mNodes[node.mOffset].mBox);
+			}
+		}
+	}
+
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::clear() {
+		mNodes.clear();
+		mIndices.clear();
+		mBoxes.clear();
+	}
+
+	template<typename T, size_t Dim>
+	size_t bvh<T, Dim>::overlap(const box_type& _box, std::vector<uint32_t>& _out) const {
+		_out.clear();
+		if (mNodes.empty()) return 0;
+
+		uint32_t stack[BVH_STACK_SIZE];
+		size_t stackSize = 0;
+		uint32_t current = 0;
+		for (;;) {
+			const node_type& node = mNodes[current];
+			if (node.mBox.overlaps(_box)) {
+				if (!node.leaf()) {
+					stack[stackSize++] = node.mOffset;
+					++current;
+					continue;
+				}
+				for (uint32_t slot = node.mOffset; slot < node.mOffset + node.mCount; ++slot)
+					if (mBoxes[slot].overlaps(_box))
+						_out.push_back(mIndices[slot]);
+			}
+			if (stackSize == 0) break;
+			current = stack[--stackSize];
+		}
+		return _out.size();
+	}
+
+	template<typename T, size_t Dim>
+	uint32_t bvh<T, Dim>::raycast(const value_type _origin[Dim], const value_type _direction[Dim], value_type& _tMax) const {
+		uint32_t slot = Raycast(_origin, _direction, _tMax, [](uint32_t, value_type _tEntry, value_type& _t) {
+			if (!(_tEntry < _t)) return false;
+			_t = _tEntry;
+			return true;
+		});
+		return (slot == npos) ? npos : mIndices[slot];
+	}
+
+	template<typename T, size_t Dim>
+	template<typename Intersect>
+	uint32_t bvh<T, Dim>::raycast(const value_type _origin[Dim], const value_type _direction[Dim], value_type& _tMax
+		, Intersect _intersect) const {
+		uint32_t slot = Raycast(_origin, _direction, _tMax, [this, &_intersect](uint32_t _slot, value_type, value_type& _t) {
+			return _intersect(mIndices[_slot], _t);
+		});
+		return (slot == npos) ? npos : mIndices[slot];
+	}
+
+	template<typename T, size_t Dim>
+	uint32_t bvh<T, Dim>::nearest(const value_type _pt[Dim], value_type& _distSqr) const {
+		uint32_t slot = Nearest(_pt, _distSqr, [this](uint32_t _slot, const value_type* _pt) {
+			return mBoxes[_slot].distance_sqr(_pt);
+		});
+		return (slot == npos) ? npos : mIndices[slot];
+	}
+
+	template<typename T, size_t Dim>
+	template<typename Distance>
+	uint32_t bvh<T, Dim>::nearest(const value_type _pt[Dim], value_type& _distSqr, Distance _distance) const {
+		uint32_t slot = Nearest(_pt, _distSqr, [this, &_distance](uint32_t _slot, const value_type* _pt) {
+			return _distance(mIndices[_slot], _pt);
+		});
+		return (slot == npos) ? npos : mIndices[slot];
+	}
+
+	/*
+	Builds the subtree of the objects _refs[_first, _last) in depth first order and returns its root. Binning sorts the
+	centers into BVH_BIN_COUNT slabs of every axis in one pass, and sweeping the bins from both ends gives the count and
+	bounds on either side of each boundary, so that every candidate plane then costs O(1).
+	*/
+	template<typename T, size_t Dim>
+	uint32_t bvh<T, Dim>::Build(BuildRef* _refs, uint32_t _first, uint32_t _last, uint32_t _depth) {
+		uint32_t current = static_cast<uint32_t>(mNodes.size());
+		mNodes.push_back(node_type());
+
+		box_type bounds, centerBounds;
+		for (uint32_t slot = _first; slot < _last; ++slot) {
+			bounds.expand(_refs[slot].mBox);
+			centerBounds.expand(_refs[slot].mCenter);
+		}
+		uint32_t count = _last - _first;
+		if (count == 1) return MakeLeaf(current, bounds, _first, _last);
+
+		uint32_t axis = 0;
+		for (uint32_t i = 1; i < Dim; ++i)
+			if (centerBounds.upper()[axis] - centerBounds.lower()[axis] < centerBounds.upper()[i] - centerBounds.lower()[i])
+				axis = i;
+		if (!(centerBounds.lower()[axis] < centerBounds.upper()[axis]) && count <= LEAF_CAPACITY)
+			return MakeLeaf(current, bounds, _first, _last);
+
+		size_t bestBoundary = 0;
+		if (_depth < BVH_SAH_DEPTH) {
+			// an axis too thin to bin gets a scale of 0, which drops every center into its first bin
+			Bin bins[Dim][BVH_BIN_COUNT];
+			value_type scales[Dim];
+			for (size_t binAxis = 0; binAxis < Dim; ++binAxis) {
+				for (size_t bin = 0; bin < BVH_BIN_COUNT; ++bin)
+					bins[binAxis][bin].mCount = 0;
+				scales[binAxis] = BVH_BIN_COUNT / (centerBounds.upper()[binAxis] - centerBounds.lower()[binAxis]);
+				if (!(scales[binAxis] <= std::numeric_limits<value_type>::max()))
+					scales[binAxis] = 0;
+			}
+			for (uint32_t slot = _first; slot < _last; ++slot) {
+				const BuildRef& ref = _refs[slot];
+				for (size_t binAxis = 0; binAxis < Dim; ++binAxis) {
+					size_t bin = static_cast<size_t>((ref.mCenter[binAxis] - centerBounds.lower()[binAxis]) * scales[binAxis]);
+					if (bin >= BVH_BIN_COUNT) bin = BVH_BIN_COUNT - 1;
+					bins[binAxis][bin].mBox.expand(ref.mBox);
+					++bins[binAxis][bin].mCount;
+				}
+			}
+
+			double bestCost = std::numeric_limits<double>::max();
+			for (uint32_t binAxis = 0; binAxis < Dim; ++binAxis) {
+				// the area and count above every boundary, then the cost of splitting at each from below
+				value_type areasAbove[BVH_BIN_COUNT];
+				uint32_t countsAbove[BVH_BIN_COUNT];
+				box_type above;
+				uint32_t countAbove = 0;
+				for (size_t boundary = BVH_BIN_COUNT - 1; boundary > 0; --boundary) {
+					above.expand(bins[binAxis][boundary].mBox);
+					countAbove += bins[binAxis][boundary].mCount;
+					areasAbove[boundary] = countAbove ? above.half_area() : 0;
+					countsAbove[boundary] = countAbove;
+				}
+				box_type below;
+				uint32_t countBelow = 0;
+				for (size_t boundary = 1; boundary < BVH_BIN_COUNT; ++boundary) {
+					below.expand(bins[binAxis][boundary - 1].mBox);
+					countBelow += bins[binAxis][boundary - 1].mCount;
+					if (countBelow == 0 || countsAbove[boundary] == 0) continue;
+					double cost = static_cast<double>(countBelow) * below.half_area()
+						+ static_cast<double>(countsAbove[boundary]) * areasAbove[boundary];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestBoundary = boundary;
+						axis = binAxis;
+					}
+				}
+			}
+
+			double area = bounds.half_area();
+			double leafCost = static_cast<double>(count);
+			double splitCost = BVH_TRAVERSAL_COST + ((area > 0) ? bestCost / area : leafCost);
+			if (count <= LEAF_CAPACITY && leafCost <= splitCost) return MakeLeaf(current, bounds, _first, _last);
+		}
+
+		uint32_t middle = _first + count / 2;
+		if (bestBoundary != 0) {
+			value_type lower = centerBounds.lower()[axis];
+			value_type scale = BVH_BIN_COUNT / (centerBounds.upper()[axis] - lower);
+			middle = static_cast<uint32_t>(std::partition(_refs + _first, _refs + _last
+				, [axis, lower, scale, bestBoundary](const BuildRef& _ref) {
+				return static_cast<size_t>((_ref.mCenter[axis] - lower) * scale) < bestBoundary;
+			}) - _refs);
+		}
+		// too deep, or the centers are too close together to bin: halving at the median keeps the tree shallow
+		if (bestBoundary == 0 || middle == _first || middle == _last) {
+			middle = _first + count / 2;
+			std::nth_element(_refs + _first, _refs + middle, _refs + _last, [axis](const BuildRef& _lhs, const BuildRef& _rhs) {
+				return _lhs.mCenter[axis] < _rhs.mCenter[axis];
+			});
+		}
+
+		Build(_refs, _first, middle, _depth + 1);
+		uint32_t right = Build(_refs, middle, _last, _depth + 1);
+		node_type& node = mNodes[current];
+		node.mBox = bounds;
+		node.mOffset = right;
+		node.mCount = 0;
+		node.mAxis = static_cast<uint16_t>(axis);
+		return current;
+	}
+
+	template<typename T, size_t Dim>
+	uint32_t bvh<T, Dim>::MakeLeaf(uint32_t _node, const box_type& _bounds, uint32_t _first, uint32_t _last) {
+		node_type& node = mNodes[_node];
+		node.mBox = _bounds;
+		node.mOffset = _first;
+		node.mCount = static_cast<uint16_t>(_last - _first);
+		node.mAxis = 0;
+		return _node;
+	}
+
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::build_linear(const box_type* _boxes, size_t _count) {
+		BuildLinear(_boxes, _count, nullptr);
+	}
+
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::build_linear(const box_type* _boxes, size_t _count, thread_pool& _pool) {
+		BuildLinear(_boxes, _count, &_pool);
+	}
+
+	/*
+	Karras' construction: once the objects are sorted, every inner node of the radix tree over their codes finds its own
+	range and split by binary searches, independently of all others. The boxes then fill in bottom up, each inner node
+	by whichever of its two children is finished last, and finally the tree is laid out in depth first order like one
+	build() makes, with every subtree of at most LEAF_CAPACITY objects collapsed into a leaf. The top of the tree is laid
+	out first, so that the subtrees below it can be laid out concurrently at the positions their sizes determine.
+	*/
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::BuildLinear(const box_type* _boxes, size_t _count, thread_pool* _pPool) {
+		assert((_count < npos / 2));
+		clear();
+		if (_count == 0) return;
+
+		SortByMortonCode(_boxes, _count, _pPool);
+		mBoxes.resize(_count);
+		cckit::parallel_for(_pPool, 0, _count, BVH_LINEAR_GRAIN, [this, _boxes](size_t _first, size_t _last) {
+			for (size_t slot = _first; slot < _last; ++slot)
+				mBoxes[slot] = _boxes[mIndices[slot]];
+		});
+		if (_count == 1) {
+			mNodes.resize(1);
+			MakeLeaf(0, mBoxes[0], 0, 1);
+			return;
+		}
+
+		uint32_t innerCount = static_cast<uint32_t>(_count - 1);
+		mLinear.mNodes.resize(innerCount);
+		mLinear.mParents.resize(innerCount + _count);
+		mLinear.mParents[0] = npos;
+		cckit::parallel_for(_pPool, 0, innerCount, BVH_LINEAR_GRAIN, [this](size_t _first, size_t _last) {
+			for (size_t node = _first; node < _last; ++node)
+				LinkLinearNode(static_cast<uint32_t>(node));
+		});
+
+		std::vector<std::atomic<uint32_t> >& arrivals = mLinear.mArrivals;
+		if (arrivals.size() < innerCount)
+			std::vector<std::atomic<uint32_t> >(innerCount).swap(arrivals);
+		cckit::parallel_for(_pPool, 0, innerCount, BVH_LINEAR_GRAIN, [&arrivals](size_t _first, size_t _last) {
+			for (size_t node = _first; node < _last; ++node)
+				arrivals[node].store(0, std::memory_order_relaxed);
+		});
+		cckit::parallel_for(_pPool, 0, _count, BVH_LINEAR_GRAIN, [this, innerCount, &arrivals](size_t _first, size_t _last) {
+			for (size_t leaf = _first; leaf < _last; ++leaf) {
+				// the first child to arrive leaves its parent to the second one, which then finds both done
+				uint32_t node = mLinear.mParents[innerCount + leaf];
+				for (; node != npos && arrivals[node].fetch_add(1, std::memory_order_acq_rel) == 1; node = mLinear.mParents[node])
+					FitLinearNodes(node);
+			}
+		});
+
+		// the subtrees below the frontier are each laid out by one thread
+		mNodes.resize(mLinear.mNodes[0].mSize);
+		size_t subtreeCount = _pPool ? 8 * _pPool->size() : 1;
+		std::vector<std::pair<uint32_t, size_t> >& subtrees = mLinear.mFrontier[0];
+		std::vector<std::pair<uint32_t, size_t> >& next = mLinear.mFrontier[1];
+		subtrees.assign(1, std::make_pair(uint32_t(0), size_t(0)));
+		while (!subtrees.empty() && subtrees.size() < subtreeCount) {
+			next.clear();
+			for (auto current = subtrees.cbegin(), end = subtrees.cend(); current != end; ++current) {
+				size_t rightPos = EmitLinearNode(current->first, current->second);
+				if (rightPos == 0) continue;
+				const LinearNode& node = mLinear.mNodes[current->first];
+				next.push_back(std::make_pair(node.mChildren[0], current->second + 1));
+				next.push_back(std::make_pair(node.mChildren[1], rightPos));
+			}
+			subtrees.swap(next);
+		}
+		cckit::parallel_for(_pPool, 0, subtrees.size(), 1, [this, &subtrees](size_t _first, size_t _last) {
+			for (size_t subtree = _first; subtree < _last; ++subtree)
+				EmitLinearSubtree(subtrees[subtree].first, subtrees[subtree].second);
+		});
+	}
+
+	// quantizes the centers over their bounding box and radix sorts the codes, 8 bits per pass, into mIndices
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::SortByMortonCode(const box_type* _boxes, size_t _count, thread_pool* _pPool) {
+		size_t chunkCount = _pPool ? 4 * _pPool->size() : 1;
+		if (chunkCount > (_count + BVH_LINEAR_GRAIN - 1) / BVH_LINEAR_GRAIN)
+			chunkCount = (_count + BVH_LINEAR_GRAIN - 1) / BVH_LINEAR_GRAIN;
+		auto chunkFirst = [_count, chunkCount](size_t _chunk) { return _count * _chunk / chunkCount; };
+
+		std::vector<box_type>& chunkBounds = mLinear.mChunkBounds;
+		chunkBounds.assign(chunkCount, box_type());
+		cckit::parallel_for(_pPool, 0, chunkCount, 1, [_boxes, &chunkBounds, &chunkFirst](size_t _first, size_t _last) {
+			for (size_t chunk = _first; chunk < _last; ++chunk) {
+				value_type center[Dim];
+				for (size_t index = chunkFirst(chunk); index < chunkFirst(chunk + 1); ++index) {
+					for (size_t i = 0; i < Dim; ++i)
+						center[i] = _boxes[index].center(i);
+					chunkBounds[chunk].expand(center);
+				}
+			}
+		});
+		box_type centerBounds;
+		for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+			centerBounds.expand(chunkBounds[chunk]);
+
+		typedef BvhMorton<Dim> morton;
+		const size_t axes = (Dim < 32) ? Dim : 32;
+		value_type scales[Dim];
+		for (size_t i = 0; i < Dim; ++i) {
+			value_type extent = centerBounds.upper()[i] - centerBounds.lower()[i];
+			scales[i] = (extent > 0) ? static_cast<value_type>((uint32_t(1) << morton::BITS) - 1) / extent : 0;
+		}
+		mLinear.mCodes.resize(_count);
+		mIndices.resize(_count);
+		cckit::parallel_for(_pPool, 0, _count, BVH_LINEAR_GRAIN, [this, _boxes, &centerBounds, &scales, axes](size_t _first, size_t _last) {
+			for (size_t index = _first; index < _last; ++index) {
+				uint32_t code = 0;
+				for (size_t i = 0; i < axes; ++i) {
+					value_type cell = (_boxes[index].center(i) - centerBounds.lower()[i]) * scales[i];
+					code |= morton::Spread(static_cast<uint32_t>(cell)) << (axes - 1 - i);
+				}
+				mLinear.mCodes[index] = code;
+				mIndices[index] = static_cast<uint32_t>(index);
+			}
+		});
+
+		// every pass scatters the chunks in order, each to where the counts of the chunks before it end
+		mLinear.mSortBuffer[0].resize(_count);
+		mLinear.mSortBuffer[1].resize(_count);
+		std::vector<uint32_t>& counts = mLinear.mRadixCounts;
+		counts.resize(chunkCount * 256);
+		const uint32_t bits = static_cast<uint32_t>(axes) * morton::BITS;
+		for (uint32_t shift = 0; shift < bits; shift += 8) {
+			std::fill(counts.begin(), counts.end(), 0);
+			cckit::parallel_for(_pPool, 0, chunkCount, 1, [this, shift, &counts, &chunkFirst](size_t _first, size_t _last) {
+				for (size_t chunk = _first; chunk < _last; ++chunk)
+					for (size_t slot = chunkFirst(chunk); slot < chunkFirst(chunk + 1); ++slot)
+						++counts[chunk * 256 + ((mLinear.mCodes[slot] >> shift) & 0xFF)];
+			});
+			uint32_t offset = 0;
+			for (size_t digit = 0; digit < 256; ++digit) {
+				for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+					uint32_t count = counts[chunk * 256 + digit];
+					counts[chunk * 256 + digit] = offset;
+					offset += count;
+				}
+			}
+			cckit::parallel_for(_pPool, 0, chunkCount, 1, [this, shift, &counts, &chunkFirst](size_t _first, size_t _last) {
+				for (size_t chunk = _first; chunk < _last; ++chunk) {
+					uint32_t* chunkCounts = counts.data() + chunk * 256;
+					for (size_t slot = chunkFirst(chunk); slot < chunkFirst(chunk + 1); ++slot) {
+						uint32_t dst = chunkCounts[(mLinear.mCodes[slot] >> shift) & 0xFF]++;
+						mLinear.mSortBuffer[0][dst] = mLinear.mCodes[slot];
+						mLinear.mSortBuffer[1][dst] = mIndices[slot];
+					}
+				}
+			});
+			mLinear.mCodes.swap(mLinear.mSortBuffer[0]);
+			mIndices.swap(mLinear.mSortBuffer[1]);
+		}
+	}
+
+	/*
+	Finds the range of objects and the split of inner node _node. Codes are compared by the length of their common prefix,
+	and equal codes by that of their positions instead, so that every code is distinct.
+	*/
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::LinkLinearNode(uint32_t _node) {
+		const int64_t count = static_cast<int64_t>(mLinear.mCodes.size());
+		const uint32_t* codes = mLinear.mCodes.data();
+		auto prefix = [codes, count](int64_t _i, int64_t _j) -> int {
+			if (_j < 0 || _j >= count) return -1;
+			uint32_t diff = codes[_i] ^ codes[_j];
+			return diff ? static_cast<int>(leading_zeros(diff))
+				: 32 + static_cast<int>(leading_zeros(static_cast<uint32_t>(_i ^ _j)));
+		};
+
+		// the range extends towards the neighbor sharing the longer prefix, as far as prefixes stay longer than on the other side
+		const int64_t i = _node;
+		const int64_t direction = (prefix(i, i + 1) > prefix(i, i - 1)) ? 1 : -1;
+		const int prefixMin = prefix(i, i - direction);
+		int64_t lengthMax = 2;
+		while (prefix(i, i + lengthMax * direction) > prefixMin)
+			lengthMax *= 2;
+		int64_t length = 0;
+		for (int64_t step = lengthMax / 2; step > 0; step /= 2)
+			if (prefix(i, i + (length + step) * direction) > prefixMin)
+				length += step;
+		const int64_t j = i + length * direction;
+
+		// the split is the last object that still shares more than the prefix of the whole range with i
+		const int prefixNode = prefix(i, j);
+		int64_t split = 0;
+		for (int64_t divisor = 2, step = length; step > 1; divisor *= 2) {
+			step = (length + divisor - 1) / divisor;
+			if (prefix(i, i + (split + step) * direction) > prefixNode)
+				split += step;
+		}
+		const int64_t gamma = i + split * direction + ((direction < 0) ? -1 : 0);
+
+		const uint32_t innerCount = static_cast<uint32_t>(count - 1);
+		LinearNode& node = mLinear.mNodes[_node];
+		node.mFirst = static_cast<uint32_t>((i < j) ? i : j);
+		node.mLast = static_cast<uint32_t>((i < j) ? j : i);
+		node.mChildren[0] = static_cast<uint32_t>((node.mFirst == gamma) ? innerCount + gamma : gamma);
+		node.mChildren[1] = static_cast<uint32_t>((node.mLast == gamma + 1) ? innerCount + gamma + 1 : gamma + 1);
+		mLinear.mParents[node.mChildren[0]] = _node;
+		mLinear.mParents[node.mChildren[1]] = _node;
+	}
+
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::FitLinearNodes(uint32_t _node) {
+		const uint32_t innerCount = static_cast<uint32_t>(mLinear.mNodes.size());
+		LinearNode& node = mLinear.mNodes[_node];
+		node.mBox = box_type();
+		node.mSize = 1;
+		for (size_t child = 0; child < 2; ++child) {
+			uint32_t ref = node.mChildren[child];
+			if (ref >= innerCount) {
+				node.mBox.expand(mBoxes[ref - innerCount]);
+				++node.mSize;
+			}
+			else {
+				node.mBox.expand(mLinear.mNodes[ref].mBox);
+				node.mSize += mLinear.mNodes[ref].mSize;
+			}
+		}
+		if (node.mLast - node.mFirst < LEAF_CAPACITY)
+			node.mSize = 1;
+	}
+
+	// lays out _ref at _pos and returns where its right child goes, or 0 if it became a leaf
+	template<typename T, size_t Dim>
+	size_t bvh<T, Dim>::EmitLinearNode(uint32_t _ref, size_t _pos) {
+		const uint32_t innerCount = static_cast<uint32_t>(mLinear.mNodes.size());
+		if (_ref >= innerCount) {
+			MakeLeaf(static_cast<uint32_t>(_pos), mBoxes[_ref - innerCount], _ref - innerCount, _ref - innerCount + 1);
+			return 0;
+		}
+		const LinearNode& linearNode = mLinear.mNodes[_ref];
+		if (linearNode.mSize == 1) {
+			MakeLeaf(static_cast<uint32_t>(_pos), linearNode.mBox, linearNode.mFirst, linearNode.mLast + 1);
+			return 0;
+		}
+
+		uint32_t left = linearNode.mChildren[0];
+		size_t rightPos = _pos + 1 + ((left >= innerCount) ? 1 : mLinear.mNodes[left].mSize);
+		const box_type& box = linearNode.mBox;
+		uint32_t axis = 0;
+		for (uint32_t i = 1; i < Dim; ++i)
+			if (box.upper()[axis] - box.lower()[axis] < box.upper()[i] - box.lower()[i])
+				axis = i;
+		node_type& node = mNodes[_pos];
+		node.mBox = box;
+		node.mOffset = static_cast<uint32_t>(rightPos);
+		node.mCount = 0;
+		node.mAxis = static_cast<uint16_t>(axis);
+		return rightPos;
+	}
+
+	template<typename T, size_t Dim>
+	void bvh<T, Dim>::EmitLinearSubtree(uint32_t _ref, size_t _pos) {
+		std::pair<uint32_t, size_t> stack[BVH_STACK_SIZE];
+		size_t stackSize = 0;
+		stack[stackSize++] = std::make_pair(_ref, _pos);
+		while (stackSize > 0) {
+			std::pair<uint32_t, size_t> current = stack[--stackSize];
+			size_t rightPos = EmitLinearNode(current.first, current.second);
+			if (rightPos == 0) continue;
+			stack[stackSize++] = std::make_pair(mLinear.mNodes[current.first].mChildren[1], rightPos);
+			stack[stackSize++] = std::make_pair(mLinear.mNodes[current.first].mChildren[0], current.second + 1);
+		}
+	}
+
+	// visits the child on the side the ray comes from first, so that hits there cut the ray short for the other one
+	template<typename T, size_t Dim>
+	template<typename Hit>
+	uint32_t bvh<T, Dim>::Raycast(const value_type* _origin, const value_type* _direction, value_type& _tMax, Hit _hit) const {
+		if (mNodes.empty()) return npos;
+
+		value_type invDirection[Dim];
+		bool negative[Dim];
+		for (size_t i = 0; i < Dim; ++i) {
+			invDirection[i] = 1 / _direction[i];
+			negative[i] = invDirection[i] < 0;
+		}
+
+		uint32_t stack[BVH_STACK_SIZE];
+		size_t stackSize = 0;
+		uint32_t current = 0, hitSlot = npos;
+		for (;;) {
+			const node_type& node = mNodes[current];
+			value_type tEntry;
+			if (BvhRayEntry(node.mBox, _origin, invDirection, negative, _tMax, tEntry)) {
+				if (!node.leaf()) {
+					if (negative[node.mAxis]) {
+						stack[stackSize++] = current + 1;
+						current = node.mOffset;
+					}
+					else {
+						stack[stackSize++] = node.mOffset;
+						++current;
+					}
+					continue;
+				}
+				for (uint32_t slot = node.mOffset; slot < node.mOffset + node.mCount; ++slot)
+					if (BvhRayEntry(mBoxes[slot], _origin, invDirection, negative, _tMax, tEntry) && _hit(slot, tEntry, _tMax))
+						hitSlot = slot;
+			}
+			if (stackSize == 0) break;
+			current = stack[--stackSize];
+		}
+		return hitSlot;
+	}
+
+	template<typename T, size_t Dim>
+	template<typename Distance>
+	uint32_t bvh<T, Dim>::Nearest(const value_type* _pt, value_type& _distSqr, Distance _distance) const {
+		_distSqr = std::numeric_limits<value_type>::max();
+		if (mNodes.empty()) return npos;
+
+		struct Pending
+		{
+			uint32_t mNode;
+			value_type mDistance;
+		};
+		Pending stack[BVH_STACK_SIZE];
+		size_t stackSize = 0;
+		uint32_t closest = npos;
+
+		Pending root = { 0, mNodes.front().mBox.distance_sqr(_pt) };
+		stack[stackSize++] = root;
+		while (stackSize > 0) {
+			Pending pending = stack[--stackSize];
+			if (!(pending.mDistance < _distSqr)) continue;
+
+			const node_type* pNode = &mNodes[pending.mNode];
+			while (!pNode->leaf()) {
+				Pending nearChild = { pending.mNode + 1, mNodes[pending.mNode + 1].mBox.distance_sqr(_pt) };
+				Pending farChild = { pNode->mOffset, mNodes[pNode->mOffset].mBox.distance_sqr(_pt) };
+				if (farChild.mDistance < nearChild.mDistance)
+					std::swap(nearChild, farChild);
+				if (farChild.mDistance < _distSqr)
+					stack[stackSize++] = farChild;
+				if (!(nearChild.mDistance < _distSqr)) break;
+				pending = nearChild;
+				pNode = &mNodes[pending.mNode];
+			}
+			if (!pNode->leaf()) continue;
+
+			for (uint32_t slot = pNode->mOffset; slot < pNode->mOffset + pNode->mCount; ++slot) {
+				if (!(mBoxes[slot].distance_sqr(_pt) < _distSqr)) continue;
+				value_type distSqr = _distance(slot, _pt);
+				if (distSqr < _distSqr) {
+					_distSqr = distSqr;
+					closest = slot;
+				}
+			}
+		}
+		return closest;
+	}
+}
+
+#endif // !CCKIT_BVH_H
@@ -2,12 +2,45 @@
 #define CCKIT_KD_TREE_H
 
 #include "../internal/config.h"
+#include "../internal/bit_scan.h"
+#include "../functional.h"
+#include "../heap.h"
+#include "../thread_pool.h"
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#ifdef CCKIT_SSE2
+#include <emmintrin.h>
+#endif // CCKIT_SSE2
+#if defined(CCKIT_AVX) || defined(CCKIT_AVX512)
+#include <immintrin.h>
+#endif // CCKIT_AVX || CCKIT_AVX512
 
 namespace cckit
 {
 	template<typename T, size_t Dim>
 	class kd_tree;
 
+	// a point found by a kd_tree query: its index in the tree and its squared distance to the query point
+	template<typename T>
+	struct kd_tree_neighbor
+	{
+		uint32_t index;
+		T distance_sqr;
+	};
+	template<typename T>
+	inline bool operator<(const kd_tree_neighbor<T>& _lhs, const kd_tree_neighbor<T>& _rhs)
+	{
+		return _lhs.distance_sqr < _rhs.distance_sqr;
+	}
+
+	/*
+	A node of a kd_tree. Nodes are stored by value in one array and refer to each other by index: an inner node splits
+	space at mSplit along mAxis, with every point of its left subtree at or below the split and every point of its right
+	subtree at or above it, and a leaf refers to a bucket of up to kd_tree::LEAF_CAPACITY points.
+	*/
 	template<typename T, size_t Dim>
 	class kd_tree_node
 	{
@@ -15,200 +48,825 @@ namespace cckit
 		typedef T value_type;
 	private:
 		typedef kd_tree_node<T, Dim> this_type;
+		static const uint32_t LEAF = ~uint32_t(0);
+	public:
+		bool leaf() const { return mAxis == LEAF; }
 	private:
-		kd_tree_node(value_type _pt[Dim]);
-		void Free();
-	private:
-		value_type mPt[Dim];
-		this_type *mpLeft, *mpRight;
+		value_type mSplit;
+		uint32_t mAxis;// LEAF for a leaf
+		uint32_t mFirst;// the left child, or the bucket of a leaf
+		uint32_t mSecond;// the right child, or the number of points in the bucket of a leaf
 
-		friend kd_tree<T, Dim>;
+		friend class kd_tree<T, Dim>;
 	};
 
+	/*
+	A kd-tree over points of Dim coordinates of type T. build() makes a balanced tree from a whole range at once by
+	splitting at the median along the axis of largest spread, down to buckets of at most LEAF_CAPACITY points, so that a
+	query visits few nodes and compares against a handful of contiguous points in each. insert() adds to the bucket a
+	point falls into and splits it at its median when it is full. Should that make the tree deeper than twice its
+	balanced depth, it rebuilds the lowest subtree on the way that is itself that much deeper than balanced instead, so
+	that even sorted points insert in amortized O(log n). The nodes and buckets such a rebuild replaces stay behind
+	unused until they outnumber the rest, when the whole tree is rebuilt.
+
+	Points are numbered in the order they were built or inserted; point(index) returns one of them.
+
+	The batch queries take _count query points laid out one after another in _pts, Dim coordinates each, and spread them
+	over a thread_pool. They visit the queries in the order of a Morton curve through their bounding box, so that
+	consecutive queries mostly touch the same nodes and buckets, and write the results to flat arrays in query order.
+	*/
 	template<typename T, size_t Dim>
 	class kd_tree
 	{
 	public:
 		typedef T value_type;
 		typedef kd_tree_node<T, Dim> node_type;
+		typedef kd_tree_neighbor<T> neighbor_type;
 	private:
 		typedef kd_tree<T, Dim> this_type;
 	public:
 		static const size_t DIM = Dim;
+		static const size_t LEAF_CAPACITY = 16;
+		static_assert(LEAF_CAPACITY <= 32, "the slots of a bucket must fit in a 32 bit mask");
 
 		kd_tree();
-		~kd_tree();
-		void insert(value_type _pt[Dim]);	
-		bool search(value_type _pt[Dim]);
-		value_type* nearest_neighbor(value_type _pt[Dim]) const;
+
+		// replaces the contents with the points of [_first, _last), each of which is indexable by an axis like T[Dim]
+		template<typename RandomAccessIterator>
+		void build(RandomAccessIterator _first, RandomAccessIterator _last);
+		void insert(const value_type _pt[Dim]);
+		void clear();
+
+		size_t size() const { return mPoints.size() / Dim; }
+		bool empty() const { return mPoints.empty(); }
+		const value_type* point(size_t _index) const { return mPoints.data() + _index * Dim; }
+
+		bool search(const value_type _pt[Dim]) const;
+		// the closest point to _pt, valid until the next insertion, or nullptr if the tree is empty
+		const value_type* nearest_neighbor(const value_type _pt[Dim]) const;
+		// writes the min(_k, size()) points closest to _pt to _out, closest first, and returns how many there are
+		size_t knn(const value_type _pt[Dim], size_t _k, neighbor_type* _out) const;
+		/*
+		Replaces the contents of _out with every point within _radius of _pt, in no particular order, and returns how many
+		there are. _out keeps its capacity, so reusing it across queries stops allocating once it has grown large enough.
+		*/
+		size_t radius_search(const value_type _pt[Dim], value_type _radius, std::vector<neighbor_type>& _out) const;
+
+		// writes the index of the closest point to each query to _out[query]; nothing is written if the tree is empty
+		void nearest_neighbors(const value_type* _pts, size_t _count, uint32_t* _out, thread_pool& _pool) const;
+		// writes the neighbors of each query to _out[query * _k], as knn() would, and returns min(_k, size())
+		size_t knn(const value_type* _pts, size_t _count, size_t _k, neighbor_type* _out, thread_pool& _pool) const;
+		// replaces the contents of _out with the neighbors of every query, those of a query in [_offsets[query],
+		// _offsets[query + 1]), and resizes _offsets to _count + 1
+		void radius_search(const value_type* _pts, size_t _count, value_type _radius
+			, std::vector<neighbor_type>& _out, std::vector<size_t>& _offsets, thread_pool& _pool) const;
 
 		template<typename Func>
-		void iterate(Func _func);
+		void iterate(Func _func) const;
+
 	private:
-		node_type* InsertRec(value_type _pt[Dim], node_type*& _pRoot, size_t _depth);
-		bool SearchRec(value_type _pt[Dim], node_type* _pRoot, size_t _depth) const;
-		bool Identical(value_type _pt0[Dim], value_type _pt1[Dim]) const;
-		void NearestNeighbor(node_type* _pRoot, value_type _pt[Dim], value_type(&_closestPt)[Dim], value_type& _minDist, size_t _depth) const;
-		void AssignArray(value_type(&_pt0)[Dim], value_type _pt1[Dim]) const;
-		value_type Distance(value_type _pt0[Dim], value_type _pt1[Dim]) const;
+		struct NearestVisitor;
+		struct KnnVisitor;
+		struct RadiusVisitor;
+
+		template<typename Visitor>
+		void Query(const value_type* _pt, Visitor& _visitor) const;
+		void CurveOrder(const value_type* _pts, size_t _count, std::vector<uint32_t>& _order) const;
+		uint32_t Build(uint32_t* _first, uint32_t* _last);
+		void MakeLeaf(uint32_t _node, uint32_t _bucket, const uint32_t* _first, const uint32_t* _last);
+		uint32_t WidestAxis(const uint32_t* _first, const uint32_t* _last) const;
+		void Rebuild();
+		void RebuildSubtree(const uint32_t* _path, uint32_t _depth, uint32_t _index);
+		size_t Count(uint32_t _node) const;
+		uint32_t MaxDepth() const { return MaxDepth(size()); }
+		static uint32_t MaxDepth(size_t _count);
+
+		value_type Coordinate(uint32_t _index, uint32_t _axis) const { return mPoints[_index * Dim + _axis]; }
+		const value_type* Bucket(uint32_t _bucket) const { return mBuckets.data() + _bucket * LEAF_CAPACITY * Dim; }
+		void StoreInBucket(uint32_t _bucket, uint32_t _slot, const value_type* _pt, uint32_t _index);
+		value_type DistanceSquared(const value_type* _pt0, const value_type* _pt1) const;
 
-		template<typename Func>
-		void IterateRec(Func _func, node_type* _pRoot);
 	private:
-		node_type* mpRoot;
+		std::vector<node_type> mNodes;// the root is node 0
+		// the coordinates of every bucket's points, LEAF_CAPACITY slots per bucket, and the index of each. A bucket is
+		// structure of arrays: LEAF_CAPACITY first coordinates, then LEAF_CAPACITY second ones and so on
+		std::vector<value_type> mBuckets;
+		std::vector<uint32_t> mBucketIndices;
+		std::vector<value_type> mPoints;// by index
+		size_t mUnusedNodes;// left behind by RebuildSubtree()
 	};
+}
+
+namespace cckit
+{
+	namespace
+	{
+		// deep enough for any tree kd_tree::MaxDepth() allows
+		const size_t KD_TREE_STACK_SIZE = 128;
+		// the number of consecutive queries of a batch a thread claims at once
+		const size_t KD_TREE_BATCH_GRAIN = 256;
+
+		// the widest vectors of T the target guarantees; WIDTH 0 leaves leaf scans to the scalar loop
+		template<typename T>
+		struct KdTreeSimd
+		{
+			static const size_t WIDTH = 0;
+		};
+
+#if defined(CCKIT_AVX512)
+		template<>
+		struct KdTreeSimd<float>
+		{
+			typedef __m512 vector_type;
+			static const size_t WIDTH = 16;
+
+			static vector_type Broadcast(float _val) { return _mm512_set1_ps(_val); }
+			static vector_type Load(const float* _ptr) { return _mm512_loadu_ps(_ptr); }
+			static void Store(float* _ptr, vector_type _v) { _mm512_storeu_ps(_ptr, _v); }
+			static vector_type Subtract(vector_type _a, vector_type _b) { return _mm512_sub_ps(_a, _b); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) { return _mm512_fmadd_ps(_a, _b, _acc); }
+		};
+		template<>
+		struct KdTreeSimd<double>
+		{
+			typedef __m512d vector_type;
+			static const size_t WIDTH = 8;
+
+			static vector_type Broadcast(double _val) { return _mm512_set1_pd(_val); }
+			static vector_type Load(const double* _ptr) { return _mm512_loadu_pd(_ptr); }
+			static void Store(double* _ptr, vector_type _v) { _mm512_storeu_pd(_ptr, _v); }
+			static vector_type Subtract(vector_type _a, vector_type _b) { return _mm512_sub_pd(_a, _b); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) { return _mm512_fmadd_pd(_a, _b, _acc); }
+		};
+		template<>
+		struct KdTreeSimd<int>
+		{
+			typedef __m512i vector_type;
+			static const size_t WIDTH = 16;
+
+			static vector_type Broadcast(int _val) { return _mm512_set1_epi32(_val); }
+			static vector_type Load(const int* _ptr) { return _mm512_loadu_si512(_ptr); }
+			static void Store(int* _ptr, vector_type _v) { _mm512_storeu_si512(_ptr, _v); }
+			static vector_type Subtract(vector_type _a, vector_type _b) { return _mm512_sub_epi32(_a, _b); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm512_add_epi32(_acc, _mm512_mullo_epi32(_a, _b));
+			}
+		};
+#else
+#if defined(CCKIT_AVX)
+		template<>
+		struct KdTreeSimd<float>
+		{
+			typedef __m256 vector_type;
+			static const size_t WIDTH = 8;
+
+			static vector_type Broadcast(float _val) { return _mm256_set1_ps(_val); }
+			static vector_type Load(const float* _ptr) { return _mm256_loadu_ps(_ptr); }
+			static void Store(float* _ptr, vector_type _v) { _mm256_storeu_ps(_ptr, _v); }
+			static vector_type Subtract(vector_type _a, vector_type _b) { return _mm256_sub_ps(_a, _b); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm256_add_ps(_acc, _mm256_mul_ps(_a, _b));
+			}
+		};
+		template<>
+		struct KdTreeSimd<double>
+		{
+			typedef __m256d vector_type;
+			static const size_t WIDTH = 4;
+
+			static vector_type Broadcast(double _val) { return _mm256_set1_pd(_val); }
+			static vector_type Load(const double* _ptr) { return _mm256_loadu_pd(_ptr); }
+			static void Store(double* _ptr, vector_type _v) { _mm256_storeu_pd(_ptr, _v); }
+			static vector_type Subtract(vector_type _a, vector_type _b) { return _mm256_sub_pd(_a, _b); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm256_add_pd(_acc, _mm256_mul_pd(_a, _b));
+			}
+		};
+#elif defined(CCKIT_SSE2)
+		template<>
+		struct KdTreeSimd<float>
+		{
+			typedef __m128 vector_type;
+			static const size_t WIDTH = 4;
+
+			static vector_type Broadcast(float _val) { return _mm_set1_ps(_val); }
+			static vector_type Load(const float* _ptr) { return _mm_loadu_ps(_ptr); }
+			static void Store(float* _ptr, vector_type _v) { _mm_storeu_ps(_ptr, _v); }
+			static vector_type Subtract(vector_type _a, vector_type _b) { return _mm_sub_ps(_a, _b); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm_add_ps(_acc, _mm_mul_ps(_a, _b));
+			}
+		};
+		template<>
+		struct KdTreeSimd<double>
+		{
+			typedef __m128d vector_type;
+			static const size_t WIDTH = 2;
+
+			static vector_type Broadcast(double _val) { return _mm_set1_pd(_val); }
+			static vector_type Load(const double* _ptr) { return _mm_loadu_pd(_ptr); }
+			static void Store(double* _ptr, vector_type _v) { _mm_storeu_pd(_ptr, _v); }
+			static vector_type Subtract(vector_type _a, vector_type _b) { return _mm_sub_pd(_a, _b); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm_add_pd(_acc, _mm_mul_pd(_a, _b));
+			}
+		};
+#endif // CCKIT_AVX
+#if defined(CCKIT_AVX2)
+		template<>
+		struct KdTreeSimd<int>
+		{
+			typedef __m256i vector_type;
+			static const size_t WIDTH = 8;
+
+			static vector_type Broadcast(int _val) { return _mm256_set1_epi32(_val); }
+			static vector_type Load(const int* _ptr) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(_ptr)); }
+			static void Store(int* _ptr, vector_type _v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(_ptr), _v); }
+			static vector_type Subtract(vector_type _a, vector_type _b) { return _mm256_sub_epi32(_a, _b); }
+			static vector_type MultiplyAdd(vector_type _acc, vector_type _a, vector_type _b) {
+				return _mm256_add_epi32(_acc, _mm256_mullo_epi32(_a, _b));
+			}
+		};
+#endif // CCKIT_AVX2
+#endif // CCKIT_AVX512
+
+		/*
+		Writes the squared distances from _pt to all Capacity slots of a bucket to _distSqrs, the unused ones included. With
+		the bucket laid out axis by axis, each vector holds one coordinate of WIDTH consecutive points, so a whole bucket
+		takes Dim multiply-adds per vector of slots and no shuffles.
+		*/
+		template<typename T, size_t Dim, size_t Capacity, bool Vectorized = (KdTreeSimd<T>::WIDTH != 0)>
+		struct KdTreeLeafScan
+		{
+			static void Distances(const T* _bucket, const T* _pt, T* _distSqrs) {
+				for (size_t slot = 0; slot < Capacity; ++slot)
+					_distSqrs[slot] = T();
+				for (size_t axis = 0; axis < Dim; ++axis, _bucket += Capacity) {
+					for (size_t slot = 0; slot < Capacity; ++slot) {
+						T diff = _bucket[slot] - _pt[axis];
+						_distSqrs[slot] += diff * diff;
+					}
+				}
+			}
+		};
+		template<typename T, size_t Dim, size_t Capacity>
+		struct KdTreeLeafScan<T, Dim, Capacity, true>
+		{
+			typedef KdTreeSimd<T> simd;
+			typedef typename simd::vector_type vector_type;
+			static_assert(Capacity % simd::WIDTH == 0, "a bucket must be a whole number of vectors");
+
+			static void Distances(const T* _bucket, const T* _pt, T* _distSqrs) {
+				for (size_t slot = 0; slot < Capacity; slot += simd::WIDTH) {
+					vector_type diff = simd::Subtract(simd::Load(_bucket + slot), simd::Broadcast(_pt[0]));
+					vector_type acc = simd::MultiplyAdd(simd::Broadcast(T()), diff, diff);
+					for (size_t axis = 1; axis < Dim; ++axis) {
+						diff = simd::Subtract(simd::Load(_bucket + axis * Capacity + slot), simd::Broadcast(_pt[axis]));
+						acc = simd::MultiplyAdd(acc, diff, diff);
+					}
+					simd::Store(_distSqrs + slot, acc);
+				}
+			}
+		};
+	}
 
-	// kd_tree_node<T, Dim>
 	template<typename T, size_t Dim>
-	kd_tree_node<T, Dim>::kd_tree_node(typename kd_tree_node<T, Dim>::value_type _pt[Dim]) 
-		: mpLeft(nullptr), mpRight(nullptr) {
-		for (size_t i = 0; i < Dim; ++i)
-			mPt[i] = _pt[i];
+	kd_tree<T, Dim>::kd_tree()
+		: mNodes(), mBuckets(), mBucketIndices(), mPoints(), mUnusedNodes(0) {
+
 	}
 
 	template<typename T, size_t Dim>
-	void kd_tree_node<T, Dim>::Free() {
-		if (mpLeft)
-			mpLeft->Free();
-		if (mpRight)
-			mpRight->Free();
-		delete this;
+	template<typename RandomAccessIterator>
+	void kd_tree<T, Dim>::build(RandomAccessIterator _first, RandomAccessIterator _last) {
+		mPoints.clear();
+		mPoints.reserve((_last - _first) * Dim);
+		for (; _first != _last; ++_first)
+			for (size_t i = 0; i < Dim; ++i)
+				mPoints.push_back((*_first)[i]);
+		Rebuild();
 	}
 
-	// kd_tree<T, Dim>
 	template<typename T, size_t Dim>
-	kd_tree<T, Dim>::kd_tree()
-		: mpRoot(nullptr) {
+	void kd_tree<T, Dim>::insert(const value_type _pt[Dim]) {
+		assert((size() < ~uint32_t(0)));
+		uint32_t index = static_cast<uint32_t>(size());
+		mPoints.insert(mPoints.end(), _pt, _pt + Dim);
+		if (mNodes.empty()) {
+			Rebuild();
+			return;
+		}
+
+		uint32_t path[KD_TREE_STACK_SIZE];
+		uint32_t current = 0, depth = 0;
+		for (; !mNodes[current].leaf(); ++depth) {
+			const node_type& node = mNodes[current];
+			path[depth] = current;
+			current = (_pt[node.mAxis] < node.mSplit) ? node.mFirst : node.mSecond;
+		}
+		path[depth] = current;
+		uint32_t bucket = mNodes[current].mFirst, count = mNodes[current].mSecond;
+		if (count < LEAF_CAPACITY) {
+			StoreInBucket(bucket, count, _pt, index);
+			++mNodes[current].mSecond;
+			return;
+		}
+		if (depth + 1 > MaxDepth()) {
+			RebuildSubtree(path, depth, index);
+			return;
+		}
+
+		// splits the full bucket and the new point into two leaves at their median
+		uint32_t indices[LEAF_CAPACITY + 1];
+		std::copy(mBucketIndices.begin() + bucket * LEAF_CAPACITY, mBucketIndices.begin() + (bucket + 1) * LEAF_CAPACITY, indices);
+		indices[LEAF_CAPACITY] = index;
+		uint32_t* first = indices;
+		uint32_t* last = indices + LEAF_CAPACITY + 1;
+		uint32_t* middle = first + (LEAF_CAPACITY + 1) / 2;
+		uint32_t axis = WidestAxis(first, last);
+		std::nth_element(first, middle, last, [this, axis](uint32_t _lhs, uint32_t _rhs) {
+			return Coordinate(_lhs, axis) < Coordinate(_rhs, axis);
+		});
+
+		uint32_t left = static_cast<uint32_t>(mNodes.size());
+		uint32_t rightBucket = static_cast<uint32_t>(mBucketIndices.size() / LEAF_CAPACITY);
+		mNodes.resize(mNodes.size() + 2);
+		mBuckets.resize(mBuckets.size() + LEAF_CAPACITY * Dim);
+		mBucketIndices.resize(mBucketIndices.size() + LEAF_CAPACITY);
+		MakeLeaf(left, bucket, first, middle);
+		MakeLeaf(left + 1, rightBucket, middle, last);
+
+		node_type& node = mNodes[current];
+		node.mSplit = Coordinate(*middle, axis);
+		node.mAxis = axis;
+		node.mFirst = left;
+		node.mSecond = left + 1;
+	}
+
+	template<typename T, size_t Dim>
+	void kd_tree<T, Dim>::clear() {
+		mNodes.clear();
+		mBuckets.clear();
+		mBucketIndices.clear();
+		mPoints.clear();
+	}
+
+	template<typename T, size_t Dim>
+	bool kd_tree<T, Dim>::search(const value_type _pt[Dim]) const {
+		if (mNodes.empty()) return false;
+
+		// points equal to a split may lie on either side of it
+		uint32_t stack[KD_TREE_STACK_SIZE];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0) {
+			const node_type* pNode = &mNodes[stack[--stackSize]];
+			for (; !pNode->leaf(); pNode = &mNodes[(_pt[pNode->mAxis] < pNode->mSplit) ? pNode->mFirst : pNode->mSecond]) {
+				if (_pt[pNode->mAxis] == pNode->mSplit)
+					stack[stackSize++] = pNode->mFirst;
+			}
+			const value_type* bucket = Bucket(pNode->mFirst);
+			for (uint32_t slot = 0; slot < pNode->mSecond; ++slot) {
+				size_t axis = 0;
+				for (; axis < Dim && bucket[axis * LEAF_CAPACITY + slot] == _pt[axis]; ++axis) {}
+				if (axis == Dim) return true;
+			}
+		}
+		return false;
+	}
+
+	template<typename T, size_t Dim>
+	struct kd_tree<T, Dim>::NearestVisitor
+	{
+		bool reaches(value_type _distSqr) const { return _distSqr < mMinDistSqr; }
+		void visit(uint32_t _index, value_type _distSqr) {
+			mClosest = _index;
+			mMinDistSqr = _distSqr;
+		}
+
+		uint32_t mClosest;
+		value_type mMinDistSqr;
+	};
+
+	// keeps the closest points found so far in a max-heap on the caller's buffer, the farthest of them on top
+	template<typename T, size_t Dim>
+	struct kd_tree<T, Dim>::KnnVisitor
+	{
+		bool reaches(value_type _distSqr) const { return mCount < mK || _distSqr < mpOut->distance_sqr; }
+		void visit(uint32_t _index, value_type _distSqr) {
+			neighbor_type neighbor = { _index, _distSqr };
+			if (mCount < mK) {
+				mpOut[mCount++] = neighbor;
+				cckit::push_heap(mpOut, mpOut + mCount);
+			}
+			else {
+				*mpOut = neighbor;
+				cckit::DemoteHeap<2>(mpOut, mCount, 0, cckit::less<neighbor_type>());
+			}
+		}
+
+		neighbor_type* mpOut;
+		size_t mK;
+		size_t mCount;
+	};
+
+	template<typename T, size_t Dim>
+	struct kd_tree<T, Dim>::RadiusVisitor
+	{
+		bool reaches(value_type _distSqr) const { return !(mRadiusSqr < _distSqr); }
+		void visit(uint32_t _index, value_type _distSqr) {
+			neighbor_type neighbor = { _index, _distSqr };
+			mpOut->push_back(neighbor);
+		}
+
+		std::vector<neighbor_type>* mpOut;
+		value_type mRadiusSqr;
+	};
+
+	template<typename T, size_t Dim>
+	const typename kd_tree<T, Dim>::value_type* kd_tree<T, Dim>::nearest_neighbor(const value_type _pt[Dim]) const {
+		if (mNodes.empty()) return nullptr;
 
+		NearestVisitor visitor = { 0, std::numeric_limits<value_type>::max() };
+		Query(_pt, visitor);
+		return point(visitor.mClosest);
 	}
 
 	template<typename T, size_t Dim>
-	kd_tree<T, Dim>::~kd_tree() {
-		if (mpRoot)
-			mpRoot->Free();
+	size_t kd_tree<T, Dim>::knn(const value_type _pt[Dim], size_t _k, neighbor_type* _out) const {
+		if (mNodes.empty() || _k == 0) return 0;
+
+		KnnVisitor visitor = { _out, _k, 0 };
+		Query(_pt, visitor);
+		cckit::sort_heap(_out, _out + visitor.mCount);
+		return visitor.mCount;
 	}
 
 	template<typename T, size_t Dim>
-	void kd_tree<T, Dim>::insert(typename kd_tree<T, Dim>::value_type _pt[Dim]) {
-		InsertRec(_pt, mpRoot, 0);
+	size_t kd_tree<T, Dim>::radius_search(const value_type _pt[Dim], value_type _radius, std::vector<neighbor_type>& _out) const {
+		_out.clear();
+		if (mNodes.empty() || _radius < 0) return 0;
+
+		RadiusVisitor visitor = { &_out, _radius * _radius };
+		Query(_pt, visitor);
+		return _out.size();
 	}
 
+	/*
+	Neighboring queries along the curve mostly share their closest point, so each query starts out with the previous
+	one's as the closest candidate, which prunes most of the tree before the first leaf is even reached.
+	*/
 	template<typename T, size_t Dim>
-	bool kd_tree<T, Dim>::search(typename kd_tree<T, Dim>::value_type _pt[Dim]) {
-		return SearchRec(_pt, mpRoot, 0);
+	void kd_tree<T, Dim>::nearest_neighbors(const value_type* _pts, size_t _count, uint32_t* _out, thread_pool& _pool) const {
+		if (mNodes.empty()) return;
+
+		std::vector<uint32_t> order;
+		CurveOrder(_pts, _count, order);
+		_pool.parallel_for(0, _count, KD_TREE_BATCH_GRAIN, [this, _pts, _out, &order](size_t _first, size_t _last) {
+			uint32_t closest = 0;
+			for (size_t current = _first; current < _last; ++current) {
+				const value_type* pt = _pts + order[current] * Dim;
+				NearestVisitor visitor = { closest, DistanceSquared(pt, point(closest)) };
+				Query(pt, visitor);
+				closest = visitor.mClosest;
+				_out[order[current]] = closest;
+			}
+		});
 	}
 
 	template<typename T, size_t Dim>
-	typename kd_tree<T, Dim>::value_type* 
-		kd_tree<T, Dim>::nearest_neighbor(value_type _pt[Dim]) const {
-		value_type closestPt[Dim];
-		value_type minDist = -1;
-		NearestNeighbor(mpRoot, _pt, closestPt, minDist, 0);
-		return closestPt;
+	size_t kd_tree<T, Dim>::knn(const value_type* _pts, size_t _count, size_t _k, neighbor_type* _out, thread_pool& _pool) const {
+		if (mNodes.empty() || _k == 0) return 0;
+
+		std::vector<uint32_t> order;
+		CurveOrder(_pts, _count, order);
+		_pool.parallel_for(0, _count, KD_TREE_BATCH_GRAIN, [this, _pts, _k, _out, &order](size_t _first, size_t _last) {
+			for (size_t current = _first; current < _last; ++current)
+				knn(_pts + order[current] * Dim, _k, _out + order[current] * _k);
+		});
+		return (_k < size()) ? _k : size();
+	}
+
+	/*
+	Every block of KD_TREE_BATCH_GRAIN queries along the curve collects its neighbors in a vector of its own and counts
+	how many each query found; once the counts are summed into offsets, the blocks are scattered into _out in query order.
+	*/
+	template<typename T, size_t Dim>
+	void kd_tree<T, Dim>::radius_search(const value_type* _pts, size_t _count, value_type _radius
+		, std::vector<neighbor_type>& _out, std::vector<size_t>& _offsets, thread_pool& _pool) const {
+		_out.clear();
+		_offsets.assign(_count + 1, 0);
+		if (mNodes.empty() || _radius < 0) return;
+
+		std::vector<uint32_t> order;
+		CurveOrder(_pts, _count, order);
+		std::vector<std::vector<neighbor_type> > blocks((_count + KD_TREE_BATCH_GRAIN - 1) / KD_TREE_BATCH_GRAIN);
+		_pool.parallel_for(0, _count, KD_TREE_BATCH_GRAIN, [this, _pts, _radius, &_offsets, &order, &blocks](size_t _first, size_t _last) {
+			for (size_t block = _first / KD_TREE_BATCH_GRAIN; block * KD_TREE_BATCH_GRAIN < _last; ++block) {
+				size_t blockLast = (block + 1) * KD_TREE_BATCH_GRAIN;
+				if (blockLast > _last)
+					blockLast = _last;
+				RadiusVisitor visitor = { &blocks[block], _radius * _radius };
+				for (size_t current = block * KD_TREE_BATCH_GRAIN; current < blockLast; ++current) {
+					size_t found = blocks[block].size();
+					Query(_pts + order[current] * Dim, visitor);
+					_offsets[order[current] + 1] = blocks[block].size() - found;
+				}
+			}
+		});
+
+		for (size_t query = 0; query < _count; ++query)
+			_offsets[query + 1] += _offsets[query];
+		_out.resize(_offsets[_count]);
+		_pool.parallel_for(0, blocks.size(), 1, [_count, &_out, &_offsets, &order, &blocks](size_t _first, size_t _last) {
+			for (size_t block = _first; block < _last; ++block) {
+				typename std::vector<neighbor_type>::const_iterator found = blocks[block].begin();
+				for (size_t current = block * KD_TREE_BATCH_GRAIN; current < _count && current < (block + 1) * KD_TREE_BATCH_GRAIN; ++current) {
+					size_t query = order[current];
+					std::copy(found, found + (_offsets[query + 1] - _offsets[query]), _out.begin() + _offsets[query]);
+					found += _offsets[query + 1] - _offsets[query];
+				}
+			}
+		});
 	}
 
 	template<typename T, size_t Dim>
 	template<typename Func>
-	void kd_tree<T, Dim>::iterate(Func _func) {
-		IterateRec(_func, mpRoot);
+	void kd_tree<T, Dim>::iterate(Func _func) const {
+		value_type pt[Dim];
+		for (size_t index = 0, count = size(); index < count; ++index) {
+			std::copy(point(index), point(index) + Dim, pt);
+			_func(pt);
+		}
+	}
+
+	/*
+	Descends to the leaf containing _pt first, remembering every far child with a lower bound of the squared distance from
+	_pt to it, the larger of its splitting plane's and its parent's, then pops those children and only descends into the
+	ones whose bound the visitor still reaches.
+	"_visitor"
+	reaches(distSqr) tells whether a point at that squared distance could still be part of the result, and
+	visit(index, distSqr) is called for every such point in a leaf.
+	*/
+	template<typename T, size_t Dim>
+	template<typename Visitor>
+	void kd_tree<T, Dim>::Query(const value_type* _pt, Visitor& _visitor) const {
+		struct Pending
+		{
+			uint32_t mNode;
+			value_type mDistance;
+		};
+		Pending stack[KD_TREE_STACK_SIZE];
+		size_t stackSize = 0;
+		value_type distSqrs[LEAF_CAPACITY];
+
+		Pending root = { 0, value_type() };
+		stack[stackSize++] = root;
+		while (stackSize > 0) {
+			Pending pending = stack[--stackSize];
+			if (!_visitor.reaches(pending.mDistance)) continue;
+
+			const node_type* pNode = &mNodes[pending.mNode];
+			while (!pNode->leaf()) {
+				value_type diff = _pt[pNode->mAxis] - pNode->mSplit;
+				value_type planeDistSqr = diff * diff;
+				Pending farChild = { (diff < 0) ? pNode->mSecond : pNode->mFirst, (planeDistSqr < pending.mDistance) ? pending.mDistance : planeDistSqr };
+				stack[stackSize++] = farChild;
+				pNode = &mNodes[(diff < 0) ? pNode->mFirst : pNode->mSecond];
+			}
+			KdTreeLeafScan<value_type, Dim, LEAF_CAPACITY>::Distances(Bucket(pNode->mFirst), _pt, distSqrs);
+			// picks the candidates without a branch per slot; visiting them can only make the visitor pickier
+			uint32_t candidates = 0;
+			for (uint32_t slot = 0; slot < pNode->mSecond; ++slot)
+				candidates |= static_cast<uint32_t>(_visitor.reaches(distSqrs[slot])) << slot;
+			for (; candidates != 0; candidates &= candidates - 1) {
+				uint32_t slot = lowest_bit_index(candidates);
+				if (_visitor.reaches(distSqrs[slot]))
+					_visitor.visit(mBucketIndices[pNode->mFirst * LEAF_CAPACITY + slot], distSqrs[slot]);
+			}
+		}
 	}
 
+	/*
+	Sorts the indices of the _count points of _pts by their Morton code: the coordinates are quantized over the bounding
+	box of the points to as many bits per axis as fit in 64 bits together, whose bits are then interleaved.
+	*/
 	template<typename T, size_t Dim>
-	typename kd_tree<T, Dim>::node_type* 
-		kd_tree<T, Dim>::InsertRec(
-			typename kd_tree<T, Dim>::value_type _pt[Dim]
-			, typename kd_tree<T, Dim>::node_type*& _pRoot
-			, size_t _depth) {
-		if (!_pRoot) return _pRoot = new node_type(_pt);
-		
-		size_t curDim = (_depth) % Dim;
-		/*if (_pt[curDim] < _pRoot->mPt[curDim])
-			_pRoot->mpLeft = InsertRec(_pt, _pRoot->mpLeft, _depth + 1);
-		else
-			_pRoot->mpRight = InsertRec(_pt, _pRoot->mpRight, _depth + 1);*/
-		if (_pt[curDim] < _pRoot->mPt[curDim])
-			InsertRec(_pt, _pRoot->mpLeft, _depth + 1);
-		else
-			InsertRec(_pt, _pRoot->mpRight, _depth + 1);
+	void kd_tree<T, Dim>::CurveOrder(const value_type* _pts, size_t _count, std::vector<uint32_t>& _order) const {
+		assert((_count <= ~uint32_t(0)));
+		_order.resize(_count);
+		for (size_t i = 0; i < _count; ++i)
+			_order[i] = static_cast<uint32_t>(i);
+		if (_count < 2 || Dim > 64) return;
 
-		return _pRoot;
+		const uint32_t bits = (64 / Dim < 32) ? static_cast<uint32_t>(64 / Dim) : 32;
+
+		value_type lower[Dim], upper[Dim];
+		std::copy(_pts, _pts + Dim, lower);
+		std::copy(_pts, _pts + Dim, upper);
+		for (size_t i = 1; i < _count; ++i) {
+			const value_type* pt = _pts + i * Dim;
+			for (size_t axis = 0; axis < Dim; ++axis) {
+				if (pt[axis] < lower[axis]) lower[axis] = pt[axis];
+				if (upper[axis] < pt[axis]) upper[axis] = pt[axis];
+			}
+		}
+		double scale[Dim];
+		for (size_t axis = 0; axis < Dim; ++axis) {
+			double extent = static_cast<double>(upper[axis]) - static_cast<double>(lower[axis]);
+			scale[axis] = (extent > 0) ? static_cast<double>((uint64_t(1) << bits) - 1) / extent : 0;
+		}
+
+		std::vector<std::pair<uint64_t, uint32_t> > codes(_count);
+		for (size_t i = 0; i < _count; ++i) {
+			const value_type* pt = _pts + i * Dim;
+			uint64_t cells[Dim];
+			for (size_t axis = 0; axis < Dim; ++axis)
+				cells[axis] = static_cast<uint64_t>((static_cast<double>(pt[axis]) - static_cast<double>(lower[axis])) * scale[axis]);
+			uint64_t code = 0;
+			for (uint32_t bit = bits; bit-- > 0;)
+				for (size_t axis = 0; axis < Dim; ++axis)
+					code = (code << 1) | ((cells[axis] >> bit) & 1);
+			codes[i] = std::make_pair(code, static_cast<uint32_t>(i));
+		}
+		std::sort(codes.begin(), codes.end());
+		for (size_t i = 0; i < _count; ++i)
+			_order[i] = codes[i].second;
 	}
 
+	// builds the subtree of the points [_first, _last) in depth first order and returns its root
 	template<typename T, size_t Dim>
-	bool kd_tree<T, Dim>::SearchRec(
-			typename kd_tree<T, Dim>::value_type _pt[Dim]
-			, typename kd_tree<T, Dim>::node_type* _pRoot
-			, size_t _depth)  const {
-		if (!_pRoot) return false;
-		if (Identical(_pRoot->mPt, _pt)) return true;
+	uint32_t kd_tree<T, Dim>::Build(uint32_t* _first, uint32_t* _last) {
+		uint32_t current = static_cast<uint32_t>(mNodes.size());
+		mNodes.push_back(node_type());
+		size_t count = _last - _first;
+		if (count <= LEAF_CAPACITY) {
+			uint32_t bucket = static_cast<uint32_t>(mBucketIndices.size() / LEAF_CAPACITY);
+			mBuckets.resize(mBuckets.size() + LEAF_CAPACITY * Dim);
+			mBucketIndices.resize(mBucketIndices.size() + LEAF_CAPACITY);
+			MakeLeaf(current, bucket, _first, _last);
+			return current;
+		}
 
-		size_t curDim = (_depth) % Dim;
-		if (_pt[curDim] < _pRoot->mPt[curDim])
-			return SearchRec(_pt, _pRoot->mpLeft, _depth + 1);
-		else
-			return SearchRec(_pt, _pRoot->mpRight, _depth + 1);
+		uint32_t axis = WidestAxis(_first, _last);
+		uint32_t* middle = _first + count / 2;
+		std::nth_element(_first, middle, _last, [this, axis](uint32_t _lhs, uint32_t _rhs) {
+			return Coordinate(_lhs, axis) < Coordinate(_rhs, axis);
+		});
+		value_type split = Coordinate(*middle, axis);
+		uint32_t left = Build(_first, middle);
+		uint32_t right = Build(middle, _last);
 
+		node_type& node = mNodes[current];
+		node.mSplit = split;
+		node.mAxis = axis;
+		node.mFirst = left;
+		node.mSecond = right;
+		return current;
 	}
 
 	template<typename T, size_t Dim>
-	bool kd_tree<T, Dim>::Identical(
-		value_type _pt0[Dim]
-		, value_type _pt1[Dim]) const {
-		for (size_t i = 0; i < Dim; ++i)
-			if (_pt0[i] != _pt1[i])
-				return false;
-		return true;
+	void kd_tree<T, Dim>::MakeLeaf(uint32_t _node, uint32_t _bucket, const uint32_t* _first, const uint32_t* _last) {
+		node_type& node = mNodes[_node];
+		node.mSplit = value_type();
+		node.mAxis = node_type::LEAF;
+		node.mFirst = _bucket;
+		node.mSecond = static_cast<uint32_t>(_last - _first);
+		for (uint32_t slot = 0; _first != _last; ++_first, ++slot)
+			StoreInBucket(_bucket, slot, point(*_first), *_first);
 	}
 
 	template<typename T, size_t Dim>
-	template<typename Func>
-	void kd_tree<T, Dim>::IterateRec(Func _func, node_type* _pRoot) {
-		if (_pRoot) {
-			_func(_pRoot->mPt);
-			IterateRec(_func, _pRoot->mpLeft);
-			IterateRec(_func, _pRoot->mpRight);
+	void kd_tree<T, Dim>::StoreInBucket(uint32_t _bucket, uint32_t _slot, const value_type* _pt, uint32_t _index) {
+		value_type* bucket = mBuckets.data() + _bucket * LEAF_CAPACITY * Dim;
+		for (size_t axis = 0; axis < Dim; ++axis)
+			bucket[axis * LEAF_CAPACITY + _slot] = _pt[axis];
+		mBucketIndices[_bucket * LEAF_CAPACITY + _slot] = _index;
+	}
+
+	template<typename T, size_t Dim>
+	uint32_t kd_tree<T, Dim>::WidestAxis(const uint32_t* _first, const uint32_t* _last) const {
+		value_type lower[Dim], upper[Dim];
+		std::copy(point(*_first), point(*_first) + Dim, lower);
+		std::copy(point(*_first), point(*_first) + Dim, upper);
+		for (++_first; _first != _last; ++_first) {
+			const value_type* pt = point(*_first);
+			for (size_t i = 0; i < Dim; ++i) {
+				if (pt[i] < lower[i]) lower[i] = pt[i];
+				if (upper[i] < pt[i]) upper[i] = pt[i];
+			}
 		}
+		uint32_t axis = 0;
+		for (uint32_t i = 1; i < Dim; ++i)
+			if (upper[axis] - lower[axis] < upper[i] - lower[i])
+				axis = i;
+		return axis;
 	}
 
 	template<typename T, size_t Dim>
-	void kd_tree<T, Dim>::NearestNeighbor(
-		node_type* _pRoot, value_type _pt[Dim], value_type(&_closestPt)[Dim], value_type& _minDist, size_t _depth) const {
-		if (!_pRoot->mpLeft && !_pRoot->mpRight) {
-			value_type dist = Distance(_pRoot->mPt, _pt);
-			if (dist < _minDist) {
-				_minDist = dist;
-				AssignArray(_closestPt, _pRoot->mPt);
+	void kd_tree<T, Dim>::Rebuild() {
+		mNodes.clear();
+		mBuckets.clear();
+		mBucketIndices.clear();
+		mUnusedNodes = 0;
+		if (mPoints.empty()) return;
+
+		std::vector<uint32_t> indices(size());
+		for (size_t i = 0; i < indices.size(); ++i)
+			indices[i] = static_cast<uint32_t>(i);
+		mNodes.reserve(2 * (indices.size() / (LEAF_CAPACITY / 2)) + 1);
+		Build(indices.data(), indices.data() + indices.size());
+	}
+
+	/*
+	Splitting the leaf _path[_depth] for point _index would make the tree deeper than MaxDepth(). Walking up _path, the
+	first node whose subtree would then be deeper than MaxDepth() of its own size is the scapegoat: rebuilding just its
+	subtree, with the new point, makes it no deeper than before. The root is always such a node, so there is one.
+	*/
+	template<typename T, size_t Dim>
+	void kd_tree<T, Dim>::RebuildSubtree(const uint32_t* _path, uint32_t _depth, uint32_t _index) {
+		size_t count = mNodes[_path[_depth]].mSecond + 1;
+		uint32_t scapegoat = 0;
+		for (uint32_t i = _depth; i-- > 0;) {
+			const node_type& node = mNodes[_path[i]];
+			count += Count((node.mFirst == _path[i + 1]) ? node.mSecond : node.mFirst);
+			if (_depth + 1 - i > MaxDepth(count)) {
+				scapegoat = i;
+				break;
 			}
 		}
-		else {
-			size_t curDim = _depth % Dim;
-			if (_pt[curDim] < _pRoot->mPt[curDim]) {
-				NearestNeighbor(_pRoot->mpLeft, _pt, _closestPt, _minDist, _depth + 1);
-				if (_pt[curDim] + _minDist >= _pRoot->mPt[curDim])
-					NearestNeighbor(_pRoot->mpRight, _pt, _closestPt, _minDist, _depth + 1);
+		if (scapegoat == 0) {
+			Rebuild();
+			return;
+		}
+
+		std::vector<uint32_t> indices;
+		indices.reserve(count);
+		indices.push_back(_index);
+		uint32_t stack[KD_TREE_STACK_SIZE];
+		size_t stackSize = 0;
+		stack[stackSize++] = _path[scapegoat];
+		while (stackSize > 0) {
+			// every node of the old subtree is left unused, with the root of the new one taking the place of its root
+			const node_type& node = mNodes[stack[--stackSize]];
+			++mUnusedNodes;
+			if (node.leaf()) {
+				const uint32_t* bucketIndices = mBucketIndices.data() + node.mFirst * LEAF_CAPACITY;
+				indices.insert(indices.end(), bucketIndices, bucketIndices + node.mSecond);
 			}
 			else {
-				NearestNeighbor(_pRoot->mpRight, _pt, _closestPt, _minDist, _depth + 1);
-				if (_pt[curDim] - _minDist <= _pRoot->mPt[curDim])
-					NearestNeighbor(_pRoot->mpLeft, _pt, _closestPt, _minDist, _depth + 1);
+				stack[stackSize++] = node.mFirst;
+				stack[stackSize++] = node.mSecond;
 			}
 		}
+		if (mUnusedNodes > mNodes.size() / 2) {
+			Rebuild();
+			return;
+		}
+
+		// the new subtree goes at the end, and its root then takes the place of the old one
+		uint32_t root = Build(indices.data(), indices.data() + indices.size());
+		mNodes[_path[scapegoat]] = mNodes[root];
+	}
+
+	// the number of points in the subtree of _node
+	template<typename T, size_t Dim>
+	size_t kd_tree<T, Dim>::Count(uint32_t _node) const {
+		size_t count = 0;
+		uint32_t stack[KD_TREE_STACK_SIZE];
+		size_t stackSize = 0;
+		stack[stackSize++] = _node;
+		while (stackSize > 0) {
+			const node_type& node = mNodes[stack[--stackSize]];
+			if (node.leaf())
+				count += node.mSecond;
+			else {
+				stack[stackSize++] = node.mFirst;
+				stack[stackSize++] = node.mSecond;
+			}
+		}
+		return count;
 	}
 
+	// twice the depth of a balanced tree of _count points with buckets half full, which a built tree never exceeds
 	template<typename T, size_t Dim>
-	void kd_tree<T, Dim>::AssignArray(value_type(&_pt0)[Dim], value_type _pt1[Dim]) const {
-		for (size_t i = 0; i < Dim; ++i)
-			_pt0[i] = _pt1[i];
+	uint32_t kd_tree<T, Dim>::MaxDepth(size_t _count) {
+		uint32_t depth = 2;
+		for (size_t leaves = _count / (LEAF_CAPACITY / 2); leaves > 1; leaves >>= 1)
+			depth += 2;
+		return depth;
 	}
 
 	template<typename T, size_t Dim>
-	typename kd_tree<T, Dim>::value_type 
-		kd_tree<T, Dim>::Distance(value_type _pt0[Dim], value_type _pt1[Dim]) const {
+	typename kd_tree<T, Dim>::value_type
+		kd_tree<T, Dim>::DistanceSquared(const value_type* _pt0, const value_type* _pt1) const {
 		value_type distSqr = 0;
-		for (size_t i = 0; i < Dim; ++i)
-			distSqr += std::powf(_pt0[i] - _pt1[i], 2);
-		return sqrtf(distSqr);
+		for (size_t i = 0; i < Dim; ++i) {
+			value_type diff = _pt0[i] - _pt1[i];
+			distSqr += diff * diff;
+		}
+		return distSqr;
 	}
 }
 
-#endif // !CCKIT_KD_TREE_H
\ No newline at end of file
+#endif // !CCKIT_KD_TREE_H
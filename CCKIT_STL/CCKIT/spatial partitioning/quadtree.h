@@ -4,6 +4,8 @@
 #include "../utility.h"
 #include "../deque.h"
 #include "../math.h"
+#include <vector>
+#include <cstdint>
 
 namespace cckit 
 {
@@ -14,6 +16,13 @@ namespace cckit
 		return !cckit::equal(_lhs, _rhs);
 	}
 
+	/*
+	A region quadtree whose leaves hold up to MaxNodeSize elements each. All nodes live in one vector and refer to their
+	children by index, the four children of a node being consecutive. The elements of every leaf sit in a fixed-capacity
+	bucket of one pooled vector, so that neither nodes nor leaves are allocated one by one. A leaf that overflows hands its
+	bucket down to its first child. query_range() walks the nodes with an explicit stack instead of recursing. value_type
+	must be default constructible.
+	*/
 	template<typename T, size_t MaxNodeSize = 3>
 	class quadtree
 	{
@@ -33,7 +42,7 @@ namespace cckit
 			point operator+(const point& _other) const { point tmp = *this; return tmp += _other; }
 			bool operator==(const point& _other) const { return cckit::equal(mX, _other.mX) && cckit::equal(mY, _other.mY); }
 			bool operator!=(const point& _other) const { return !(*this == _other); }
-			void swap(const point& _other) { cckit::swap(mX, _other.mX); cckit::swap(mY, _other.mY); }
+			void swap(point& _other) { cckit::swap(mX, _other.mX); cckit::swap(mY, _other.mY); }
 		};
 		struct rect {
 			point mTopLeft, mBottomRight;
@@ -42,6 +51,7 @@ namespace cckit
 				: mTopLeft(_topLeft), mBottomRight(_bottomRight) {}
 			rect(const rect& _other)
 				: rect(_other.mTopLeft, _other.mBottomRight) {}
+			rect& operator=(const rect& _other) { mTopLeft = _other.mTopLeft; mBottomRight = _other.mBottomRight; return *this; }
 			bool contain(const point& _pt) const {
 				return !(
 					(_pt.mX < mTopLeft.mX) || (_pt.mX > mBottomRight.mX) || cckit::equal(_pt.mX, mBottomRight.mX)
@@ -59,122 +69,186 @@ namespace cckit
 		};
 
 		static constexpr size_type MAX_NODE_SIZE = MaxNodeSize;
-		typedef cckit::deque<cckit::pair<value_type, point> > elemlist_type;
+		typedef cckit::pair<value_type, point> element_type;
+		typedef cckit::deque<element_type> elemlist_type;
 
 	public:
-		quadtree() : mpElems(new elemlist_type()) {}
-		explicit quadtree(const rect& _bounds)
-			: mpElems(new elemlist_type()), mBounds(_bounds) {}
-		~quadtree();
+		quadtree() : quadtree(rect()) {}
+		explicit quadtree(const rect& _bounds);
 
+		// fails for points outside the bounds, for points already present, and for points too close together to separate
 		bool insert(const value_type& _val, const point& _pt);
 		void query_range(const rect& _range, elemlist_type& _list) const;// precondition: _list is empty
-		size_type size() const;
+		size_type size() const { return mSize; }
 
 		template<typename UnaryFunction0, typename NullaryFunction0, typename NullaryFunction1, typename NullaryFunction2>
-		void verify(UnaryFunction0 _func0, NullaryFunction0 _func1, NullaryFunction1 _func2, NullaryFunction2 _func3) {
-			if (mpElems) {
-				for (const auto& elem : *mpElems)
-					_func0(elem.first);
-				_func1();
-			}
-			else {
-				_func2();
-				for (size_type i = 0; i < 4; ++i)
-					mpSubtrees[i]->verify(_func0, _func1, _func2, _func3);
-				_func3();
-			}
+		void verify(UnaryFunction0 _func0, NullaryFunction0 _func1, NullaryFunction1 _func2, NullaryFunction2 _func3) const {
+			Verify(0, _func0, _func1, _func2, _func3);
 		}
 
 	private:
-		void Subdivide();// postcondition: mpElems = nullptr
+		struct Node
+		{
+			static const uint32_t LEAF = ~uint32_t(0);
+
+			bool leaf() const { return mChildren == LEAF; }
+
+			rect mBounds;
+			uint32_t mChildren;// the first of the four children, or LEAF
+			uint32_t mBucket;// leaves only
+			uint32_t mCount;// leaves only
+		};
+
+		uint32_t Child(const Node& _node, const point& _pt) const;
+		void Subdivide(uint32_t _node);
+		uint32_t NewLeaf(const rect& _bounds, uint32_t _bucket);
+		element_type* Bucket(uint32_t _bucket) { return mBuckets.data() + _bucket * MAX_NODE_SIZE; }
+		const element_type* Bucket(uint32_t _bucket) const { return mBuckets.data() + _bucket * MAX_NODE_SIZE; }
+
+		template<typename UnaryFunction0, typename NullaryFunction0, typename NullaryFunction1, typename NullaryFunction2>
+		void Verify(uint32_t _node
+			, UnaryFunction0& _func0, NullaryFunction0& _func1, NullaryFunction1& _func2, NullaryFunction2& _func3) const;
 
 	private:
-		this_type* mpSubtrees[4];
-		rect mBounds;
-		elemlist_type* mpElems;
+		std::vector<Node> mNodes;// the root is node 0
+		std::vector<element_type> mBuckets;// MAX_NODE_SIZE slots per leaf
+		size_type mSize;
 	};
 }
 
 namespace cckit
 {
+	namespace
+	{
+		// every level halves the cells, so deeper leaves could only separate points closer than float precision
+		const uint32_t QUADTREE_MAX_DEPTH = 64;
+		// a node at each level leaves at most three siblings behind
+		const size_t QUADTREE_STACK_SIZE = 3 * QUADTREE_MAX_DEPTH + 4;
+	}
+
 	template<typename T, size_t MaxNodeSize>
-	inline quadtree<T, MaxNodeSize>::~quadtree() {
-		if (mpElems)
-			delete mpElems;
-		else 
-			for (size_type i = 0; i < 4; ++i)
-				delete mpSubtrees[i];
+	inline quadtree<T, MaxNodeSize>::quadtree(const rect& _bounds)
+		: mNodes(), mBuckets(), mSize(0) {
+		static_assert(MaxNodeSize > 0, "a quadtree leaf must hold at least one element");
+		NewLeaf(_bounds, 0);
 	}
 
 	template<typename T, size_t MaxNodeSize>
 	bool quadtree<T, MaxNodeSize>::insert(const value_type& _val, const point& _pt) {
-		if (!mBounds.contain(_pt))
+		if (!mNodes[0].mBounds.contain(_pt))
 			return false;
 
-		if (mpElems) {
-			if (mpElems->size() != MAX_NODE_SIZE) {
-				for (const auto& elem : *mpElems)
-					if (elem.second == _pt) 
-						return false;// RET
-				mpElems->push_back(cckit::pair<value_type, point>(_val, _pt));
+		uint32_t node = 0, depth = 0;
+		for (;;) {
+			for (; !mNodes[node].leaf(); ++depth)
+				node = Child(mNodes[node], _pt);
+
+			Node& leaf = mNodes[node];
+			element_type* bucket = Bucket(leaf.mBucket);
+			for (uint32_t slot = 0; slot < leaf.mCount; ++slot)
+				if (bucket[slot].second == _pt)
+					return false;// RET
+			if (leaf.mCount != MAX_NODE_SIZE) {
+				bucket[leaf.mCount++] = element_type(_val, _pt);
+				++mSize;
 				return true;// RET
 			}
-			else
-				Subdivide();
+			if (depth == QUADTREE_MAX_DEPTH)
+				return false;// RET
+			Subdivide(node);
 		}
-		for (size_type i = 0; i < 4; ++i)
-			if (mpSubtrees[i]->insert(_val, _pt)) 
-				break;
-		return true;// RET
 	}
 
 	template<typename T, size_t MaxNodeSize>
 	void quadtree<T, MaxNodeSize>::query_range(const rect& _range, elemlist_type& _list) const {
-		if (mBounds.intersect(_range)) {
-			if (mpElems) {
-				for (const auto& elem : *mpElems)
-					if (_range.contain(elem.second))
-						_list.push_back(elem);
+		uint32_t stack[QUADTREE_STACK_SIZE];
+		size_t stackSize = 0;
+		stack[stackSize++] = 0;
+		while (stackSize > 0) {
+			const Node& node = mNodes[stack[--stackSize]];
+			if (!node.mBounds.intersect(_range))
+				continue;
+
+			if (node.leaf()) {
+				const element_type* bucket = Bucket(node.mBucket);
+				for (uint32_t slot = 0; slot < node.mCount; ++slot)
+					if (_range.contain(bucket[slot].second))
+						_list.push_back(bucket[slot]);
 			}
 			else
-				for (size_type i = 0; i < 4; mpSubtrees[i]->query_range(_range, _list), ++i) {}
+				for (uint32_t i = 4; i-- > 0; stack[stackSize++] = node.mChildren + i) {}// child 0 comes out first
 		}
 	}
 
+	/*
+	The children, in order, are the top right, top left, bottom left and bottom right quarters. Points on a line between
+	them go right or down, by plain comparison with the center. So a point always has a child, even within FLT_EPSILON of
+	the center where rect::contain() would reject it from both sides.
+	*/
 	template<typename T, size_t MaxNodeSize>
-	typename quadtree<T, MaxNodeSize>::size_type 
-		quadtree<T, MaxNodeSize>::size() const {
-		if (!mpElems) {
-			size_type sz = 0;
-			for (size_type i = 0; i < 4; ++i)
-				sz += mpSubtrees[i]->size();
-			return sz;
-		}
-		return mpElems->size();
+	inline uint32_t quadtree<T, MaxNodeSize>::Child(const Node& _node, const point& _pt) const {
+		const rect& bounds = _node.mBounds;
+		bool right = _pt.mX >= (bounds.mTopLeft.mX + bounds.mBottomRight.mX) / 2;
+		bool bottom = _pt.mY >= (bounds.mTopLeft.mY + bounds.mBottomRight.mY) / 2;
+		return _node.mChildren + (bottom ? (right ? 3 : 2) : (right ? 0 : 1));
 	}
 
 	template<typename T, size_t MaxNodeSize>
-	void quadtree<T, MaxNodeSize>::Subdivide() {
-		float x0 = mBounds.mTopLeft.mX, y0 = mBounds.mTopLeft.mY
-			, x2 = mBounds.mBottomRight.mX, y2 = mBounds.mBottomRight.mY
+	void quadtree<T, MaxNodeSize>::Subdivide(uint32_t _node) {
+		rect bounds = mNodes[_node].mBounds;
+		uint32_t bucket = mNodes[_node].mBucket, count = mNodes[_node].mCount;
+		float x0 = bounds.mTopLeft.mX, y0 = bounds.mTopLeft.mY
+			, x2 = bounds.mBottomRight.mX, y2 = bounds.mBottomRight.mY
 			, x1 = (x0 + x2) / 2, y1 = (y0 + y2) / 2;
 
-		mpSubtrees[0] = new this_type(rect(point(x1, y0), point(x2, y1)));
-		mpSubtrees[1] = new this_type(rect(point(x0, y0), point(x1, y1)));
-		mpSubtrees[2] = new this_type(rect(point(x0, y1), point(x1, y2)));
-		mpSubtrees[3] = new this_type(rect(point(x1, y1), point(x2, y2)));
+		uint32_t bucketCount = static_cast<uint32_t>(mBuckets.size() / MAX_NODE_SIZE);
+		uint32_t children = NewLeaf(rect(point(x1, y0), point(x2, y1)), bucket);
+		NewLeaf(rect(point(x0, y0), point(x1, y1)), bucketCount);
+		NewLeaf(rect(point(x0, y1), point(x1, y2)), bucketCount + 1);
+		NewLeaf(rect(point(x1, y1), point(x2, y2)), bucketCount + 2);
+		Node& node = mNodes[_node];
+		node.mChildren = children;
+		node.mCount = 0;
+
+		// the first child keeps its elements in place, ahead of the slots they are read from
+		element_type* elems = Bucket(bucket);
+		for (uint32_t slot = 0; slot < count; ++slot) {
+			Node& child = mNodes[Child(node, elems[slot].second)];
+			Bucket(child.mBucket)[child.mCount++] = elems[slot];
+		}
+	}
 
-		while (!mpElems->empty()) {
-			for (size_type i = 0; i < 4; ++i) {
-				auto back = mpElems->back();
-				if (mpSubtrees[i]->insert(back.first, back.second)) 
-					break;
-			}
-			mpElems->pop_back();
+	// appends a leaf using bucket _bucket, which is allocated if it is the next one, and returns its index
+	template<typename T, size_t MaxNodeSize>
+	uint32_t quadtree<T, MaxNodeSize>::NewLeaf(const rect& _bounds, uint32_t _bucket) {
+		if (_bucket * MAX_NODE_SIZE == mBuckets.size())
+			mBuckets.resize(mBuckets.size() + MAX_NODE_SIZE);
+		Node leaf;
+		leaf.mBounds = _bounds;
+		leaf.mChildren = Node::LEAF;
+		leaf.mBucket = _bucket;
+		leaf.mCount = 0;
+		mNodes.push_back(leaf);
+		return static_cast<uint32_t>(mNodes.size() - 1);
+	}
+
+	template<typename T, size_t MaxNodeSize>
+	template<typename UnaryFunction0, typename NullaryFunction0, typename NullaryFunction1, typename NullaryFunction2>
+	void quadtree<T, MaxNodeSize>::Verify(uint32_t _node
+		, UnaryFunction0& _func0, NullaryFunction0& _func1, NullaryFunction1& _func2, NullaryFunction2& _func3) const {
+		const Node& node = mNodes[_node];
+		if (node.leaf()) {
+			const element_type* bucket = Bucket(node.mBucket);
+			for (uint32_t slot = 0; slot < node.mCount; ++slot)
+				_func0(bucket[slot].first);
+			_func1();
+		}
+		else {
+			_func2();
+			for (uint32_t i = 0; i < 4; ++i)
+				Verify(node.mChildren + i, _func0, _func1, _func2, _func3);
+			_func3();
 		}
-		delete mpElems;
-		mpElems = nullptr;
 	}
 }
 
@@ -0,0 +1,146 @@
+#ifndef CCKIT_THREAD_POOL_H
+#define CCKIT_THREAD_POOL_H
+
+#include "internal/config.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace cckit
+{
+	/*
+	A fixed set of worker threads for data parallel loops. parallel_for() splits an index range into chunks that the
+	workers and the calling thread claim from a shared counter, and returns once every chunk has been processed. The
+	threads sleep between loops, so a pool is meant to be created once and reused, e.g. for every level of a search.
+
+	"_threadCount"
+	The number of threads working on a loop, including the calling one; 0 picks std::thread::hardware_concurrency().
+	*/
+	class thread_pool
+	{
+		typedef thread_pool this_type;
+	public:
+		explicit thread_pool(size_t _threadCount = 0);
+		~thread_pool();
+		thread_pool(const this_type&) = delete;
+		this_type& operator=(const this_type&) = delete;
+
+		size_t size() const { return mWorkers.size() + 1; }
+
+		// calls _func(first, last) for consecutive subranges of [_first, _last) of at most _grain indices each.
+		// Chunks run concurrently, so _func must only write state that belongs to its own subrange. Not reentrant.
+		template<typename Function>
+		void parallel_for(size_t _first, size_t _last, size_t _grain, Function _func);
+
+	private:
+		void WorkerLoop();
+		void RunChunks();
+
+	private:
+		std::vector<std::thread> mWorkers;
+		std::mutex mMutex;
+		std::condition_variable mWake;
+		std::condition_variable mDone;
+		std::function<void(size_t, size_t)> mJob;
+		std::atomic<size_t> mNext;
+		size_t mLast;
+		size_t mGrain;
+		size_t mGeneration;// bumped for every loop so that sleeping workers notice new work
+		size_t mBusy;
+		bool mStop;
+	};
+
+	// thread_pool::parallel_for() on _pPool if there is one, and a single _func(_first, _last) right here otherwise
+	template<typename Function>
+	void parallel_for(thread_pool* _pPool, size_t _first, size_t _last, size_t _grain, Function _func);
+}
+
+namespace cckit
+{
+	inline thread_pool::thread_pool(size_t _threadCount)
+		: mWorkers(), mMutex(), mWake(), mDone(), mJob(), mNext(0), mLast(0), mGrain(1), mGeneration(0), mBusy(0), mStop(false)
+	{
+		if (_threadCount == 0)
+			_threadCount = std::thread::hardware_concurrency();
+		for (size_t i = 1; i < _threadCount; ++i)
+			mWorkers.push_back(std::thread([this]() { WorkerLoop(); }));
+	}
+
+	inline thread_pool::~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mWake.notify_all();
+		for (auto current = mWorkers.begin(), end = mWorkers.end(); current != end; ++current)
+			current->join();
+	}
+
+	template<typename Function>
+	void thread_pool::parallel_for(size_t _first, size_t _last, size_t _grain, Function _func)
+	{
+		if (_first >= _last) return;
+		if (_grain == 0) _grain = 1;
+		// a single chunk is not worth waking anybody up for
+		if (mWorkers.empty() || _last - _first <= _grain) {
+			_func(_first, _last);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mJob = _func;
+			mNext.store(_first);
+			mLast = _last;
+			mGrain = _grain;
+			mBusy = mWorkers.size();
+			++mGeneration;
+		}
+		mWake.notify_all();
+		RunChunks();
+
+		std::unique_lock<std::mutex> lock(mMutex);
+		mDone.wait(lock, [this]() { return mBusy == 0; });
+		mJob = nullptr;
+	}
+
+	inline void thread_pool::WorkerLoop()
+	{
+		size_t generation = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mWake.wait(lock, [this, generation]() { return mStop || mGeneration != generation; });
+				if (mStop) return;
+				generation = mGeneration;
+			}
+			RunChunks();
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				if (--mBusy == 0)
+					mDone.notify_one();
+			}
+		}
+	}
+
+	inline void thread_pool::RunChunks()
+	{
+		for (size_t first = mNext.fetch_add(mGrain); first < mLast; first = mNext.fetch_add(mGrain))
+			mJob(first, (mLast - first < mGrain) ? mLast : first + mGrain);
+	}
+
+	template<typename Function>
+	void parallel_for(thread_pool* _pPool, size_t _first, size_t _last, size_t _grain, Function _func)
+	{
+		if (_pPool)
+			_pPool->parallel_for(_first, _last, _grain, _func);
+		else if (_first < _last)
+			_func(_first, _last);
+	}
+}
+
+#endif // !CCKIT_THREAD_POOL_H
@@ -17,9 +17,12 @@
 #include "CCKIT/experimental/csv_map.h"
 #include "CCKIT/experimental/maze_gen.h"
 #include "CCKIT/math/matrix.h"
+#include "CCKIT/math/dynamic_matrix.h"
 #include "CCKIT/math/arithmetic.h"
 #include "CCKIT/spatial partitioning/quadtree.h"
 #include "CCKIT/spatial partitioning/kd_tree.h"
+#include "CCKIT/spatial partitioning/bvh.h"
+#include "CCKIT/thread_pool.h"
 
 #include <list>
 #include <string>
@@ -31,6 +34,8 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <random>
+#include <cmath>
 
 #include <iostream>
 using std::cout; using std::endl;
@@ -439,6 +444,71 @@ void test_matrix()
 	//cout << cckit::determinant(mat) << endl;
 }
 
+void test_dynamic_matrix()
+{
+	typedef cckit::dynamic_matrix<double> matrix_type;
+	auto naiveMultiply = [](const matrix_type& _mat0, const matrix_type& _mat1) {
+		matrix_type result(_mat0.rows(), _mat1.cols());
+		for (size_t i = 0; i < _mat0.rows(); ++i)
+			for (size_t j = 0; j < _mat1.cols(); ++j) {
+				double sum = 0;
+				for (size_t k = 0; k < _mat0.cols(); ++k)
+					sum += _mat0.at(i, k) * _mat1.at(k, j);
+				result.at(i, j) = sum;
+			}
+		return result;
+	};
+	auto maxDifference = [](const matrix_type& _mat0, const matrix_type& _mat1) {
+		double diff = 0;
+		for (size_t i = 0; i < _mat0.rows(); ++i)
+			for (size_t j = 0; j < _mat0.cols(); ++j)
+				if (std::fabs(_mat0.at(i, j) - _mat1.at(i, j)) > diff)
+					diff = std::fabs(_mat0.at(i, j) - _mat1.at(i, j));
+		return diff;
+	};
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<double> element(-1.0, 1.0);
+	cckit::thread_pool pool;
+	// just below, at and past one panel of the blocked kernels, and past two
+	const size_t sizes[] = { 63, 64, 65, 130 };
+	for (size_t size : sizes) {
+		matrix_type mat0(size, size), mat1(size, size);
+		for (size_t i = 0; i < size; ++i)
+			for (size_t j = 0; j < size; ++j) {
+				mat0.at(i, j) = element(rng);
+				mat1.at(i, j) = element(rng);
+			}
+		cout << "size " << size << endl;
+
+		matrix_type product = naiveMultiply(mat0, mat1);
+		cout << "gemm " << maxDifference(cckit::multiply(mat0, mat1), product)
+			<< ", pooled " << maxDifference(cckit::multiply(mat0, mat1, pool), product) << endl;
+
+		// L * U has to give back the rows of A in pivot order
+		cckit::dynamic_lu_decomposition<double> lu(mat0), pooledLu(mat0, pool);
+		matrix_type lower(size, size), upper(size, size), permuted(size, size);
+		for (size_t i = 0; i < size; ++i)
+			for (size_t j = 0; j < size; ++j) {
+				lower.at(i, j) = (j < i) ? lu.lu().at(i, j) : (j == i) ? 1.0 : 0.0;
+				upper.at(i, j) = (j < i) ? 0.0 : lu.lu().at(i, j);
+				permuted.at(i, j) = mat0.at(lu.pivot(i), j);
+			}
+		cout << "lu " << maxDifference(naiveMultiply(lower, upper), permuted)
+			<< ", solve " << maxDifference(naiveMultiply(mat0, lu.solve(mat1)), mat1)
+			<< ", pooled solve " << maxDifference(naiveMultiply(mat0, pooledLu.solve(mat1)), mat1) << endl;
+
+		// A * A^T + size * I is symmetric positive definite
+		matrix_type spd = naiveMultiply(mat0, mat0.transpose());
+		for (size_t i = 0; i < size; ++i)
+			spd.at(i, i) += static_cast<double>(size);
+		cckit::dynamic_cholesky_decomposition<double> cholesky(spd), pooledCholesky(spd, pool);
+		cout << "cholesky " << maxDifference(naiveMultiply(cholesky.lower(), cholesky.lower().transpose()), spd)
+			<< ", pooled " << maxDifference(naiveMultiply(pooledCholesky.lower(), pooledCholesky.lower().transpose()), spd)
+			<< ", solve " << maxDifference(naiveMultiply(spd, cholesky.solve(mat1)), mat1) << endl;
+	}
+}
+
 void test_deque()
 {
 	{
@@ -524,6 +594,39 @@ void test_quadtree()
 	});*/
 }
 
+void test_quadtree_query_range()
+{
+	typedef cckit::quadtree<int> tree_type;
+	tree_type qt(tree_type::rect(tree_type::point(0.0f, 0.0f), tree_type::point(100.0f, 100.0f)));
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<float> coordinate(0.0f, 100.0f);
+	std::vector<tree_type::point> points;
+	for (int i = 0; i < 5000; ++i) {
+		tree_type::point pt(coordinate(rng), coordinate(rng));
+		if (qt.insert(static_cast<int>(points.size()), pt))
+			points.push_back(pt);
+	}
+
+	// every range against every point
+	size_t mismatches = 0;
+	for (int query = 0; query < 500; ++query) {
+		float x0 = coordinate(rng), x1 = coordinate(rng), y0 = coordinate(rng), y1 = coordinate(rng);
+		tree_type::rect range(tree_type::point(x0 < x1 ? x0 : x1, y0 < y1 ? y0 : y1), tree_type::point(x0 < x1 ? x1 : x0, y0 < y1 ? y1 : y0));
+		tree_type::elemlist_type list;
+		qt.query_range(range, list);
+		std::vector<int> found, expected;
+		for (size_t i = 0; i < list.size(); ++i)
+			found.push_back(list[i].first);
+		std::sort(found.begin(), found.end());
+		for (size_t i = 0; i < points.size(); ++i)
+			if (range.contain(points[i]))
+				expected.push_back(static_cast<int>(i));
+		if (found != expected)
+			++mismatches;
+	}
+	cout << qt.size() << " points, query_range mismatches " << mismatches << endl;
+}
+
 void test_kd_tree()
 {
 	int pt0[2]{ 1, 7 }
@@ -555,6 +658,185 @@ void test_kd_tree()
 	//cout << tree0.search(pt) << endl;
 }
 
+void test_kd_tree_queries()
+{
+	typedef cckit::kd_tree<float, 3> tree_type;
+	const size_t BUILT = 1000, COUNT = 2000, QUERIES = 200, K = 8;
+	const float radius = 10.0f;
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> coordinate(0.0f, 100.0f);
+	static float points[COUNT][3], queries[QUERIES][3];
+	for (size_t i = 0; i < COUNT; ++i)
+		for (size_t axis = 0; axis < 3; ++axis)
+			points[i][axis] = coordinate(rng);
+	for (size_t i = 0; i < QUERIES; ++i)
+		for (size_t axis = 0; axis < 3; ++axis)
+			queries[i][axis] = coordinate(rng);
+	// half of the points are built, and the rest inserted sorted along x, the worst case for the depth of the tree
+	for (size_t i = BUILT; i < COUNT; ++i)
+		points[i][0] = (i - BUILT) * 0.05f;
+	tree_type tree;
+	tree.build(points, points + BUILT);
+	for (size_t i = BUILT; i < COUNT; ++i)
+		tree.insert(points[i]);
+
+	// every query against every point
+	size_t knnMismatches = 0, radiusMismatches = 0;
+	std::vector<tree_type::neighbor_type> neighbors(QUERIES * K), found;
+	std::vector<std::vector<uint32_t> > within(QUERIES);
+	for (size_t query = 0; query < QUERIES; ++query) {
+		std::vector<float> distSqrs(COUNT);
+		for (size_t i = 0; i < COUNT; ++i) {
+			float distSqr = 0;
+			for (size_t axis = 0; axis < 3; ++axis)
+				distSqr += (points[i][axis] - queries[query][axis]) * (points[i][axis] - queries[query][axis]);
+			distSqrs[i] = distSqr;
+			if (!(radius * radius < distSqr))
+				within[query].push_back(static_cast<uint32_t>(i));
+		}
+		std::partial_sort(distSqrs.begin(), distSqrs.begin() + K, distSqrs.end());
+
+		tree_type::neighbor_type* pNeighbors = neighbors.data() + query * K;
+		if (tree.knn(queries[query], K, pNeighbors) != K)
+			++knnMismatches;
+		else
+			for (size_t i = 0; i < K; ++i)
+				if (std::fabs(pNeighbors[i].distance_sqr - distSqrs[i]) > 1e-3f) {
+					++knnMismatches;
+					break;
+				}
+
+		tree.radius_search(queries[query], radius, found);
+		std::vector<uint32_t> indices;
+		for (size_t i = 0; i < found.size(); ++i)
+			indices.push_back(found[i].index);
+		std::sort(indices.begin(), indices.end());
+		if (indices != within[query])
+			++radiusMismatches;
+	}
+	cout << "knn mismatches " << knnMismatches << ", radius_search mismatches " << radiusMismatches << endl;
+
+	// the batches against the single queries checked above
+	cckit::thread_pool pool;
+	std::vector<tree_type::neighbor_type> batchNeighbors(QUERIES * K);
+	std::vector<size_t> offsets;
+	tree.knn(&queries[0][0], QUERIES, K, batchNeighbors.data(), pool);
+	tree.radius_search(&queries[0][0], QUERIES, radius, found, offsets, pool);
+	knnMismatches = radiusMismatches = 0;
+	for (size_t query = 0; query < QUERIES; ++query) {
+		for (size_t i = 0; i < K; ++i)
+			if (batchNeighbors[query * K + i].distance_sqr != neighbors[query * K + i].distance_sqr) {
+				++knnMismatches;
+				break;
+			}
+		std::vector<uint32_t> indices;
+		for (size_t i = offsets[query]; i < offsets[query + 1]; ++i)
+			indices.push_back(found[i].index);
+		std::sort(indices.begin(), indices.end());
+		if (indices != within[query])
+			++radiusMismatches;
+	}
+	cout << "batch knn mismatches " << knnMismatches << ", batch radius_search mismatches " << radiusMismatches << endl;
+}
+
+void test_bvh()
+{
+	typedef cckit::bvh<float, 3> bvh_type;
+	typedef bvh_type::box_type box_type;
+	const size_t COUNT = 2000, QUERIES = 500;
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> coordinate(0.0f, 100.0f), extent(0.1f, 3.0f), direction(-1.0f, 1.0f);
+	std::vector<box_type> boxes(COUNT);
+	for (size_t i = 0; i < COUNT; ++i) {
+		float lower[3], upper[3];
+		for (size_t axis = 0; axis < 3; ++axis) {
+			lower[axis] = coordinate(rng);
+			upper[axis] = lower[axis] + extent(rng);
+		}
+		boxes[i] = box_type(lower, upper);
+	}
+
+	// every query against every box
+	auto check = [&](const bvh_type& _bvh, const char* _name) {
+		size_t raycastMismatches = 0, nearestMismatches = 0, overlapMismatches = 0;
+		std::vector<uint32_t> found, expected;
+		for (size_t query = 0; query < QUERIES; ++query) {
+			float origin[3], dir[3], lower[3], upper[3];
+			for (size_t axis = 0; axis < 3; ++axis) {
+				origin[axis] = coordinate(rng);
+				dir[axis] = direction(rng);
+				lower[axis] = coordinate(rng);
+				upper[axis] = lower[axis] + 10.0f * extent(rng);
+			}
+
+			// the slab test, the ray entering a box where it has passed all of its lower planes and none of its upper ones
+			float bestT = 1000.0f;
+			bool bHit = false;
+			for (size_t i = 0; i < COUNT; ++i) {
+				float tNear = 0, tFar = 1000.0f;
+				for (size_t axis = 0; axis < 3; ++axis) {
+					float t0 = (boxes[i].lower()[axis] - origin[axis]) / dir[axis];
+					float t1 = (boxes[i].upper()[axis] - origin[axis]) / dir[axis];
+					if (t0 > t1) { float t = t0; t0 = t1; t1 = t; }
+					if (t0 > tNear) tNear = t0;
+					if (t1 < tFar) tFar = t1;
+				}
+				if (tNear <= tFar && tNear < bestT) {
+					bestT = tNear;
+					bHit = true;
+				}
+			}
+			float t = 1000.0f;
+			bool bFound = _bvh.raycast(origin, dir, t) != bvh_type::npos;
+			if (bFound != bHit || (bHit && std::fabs(t - bestT) > 1e-3f))
+				++raycastMismatches;
+
+			float bestDistSqr = boxes[0].distance_sqr(origin);
+			for (size_t i = 1; i < COUNT; ++i)
+				if (boxes[i].distance_sqr(origin) < bestDistSqr)
+					bestDistSqr = boxes[i].distance_sqr(origin);
+			float distSqr;
+			if (_bvh.nearest(origin, distSqr) == bvh_type::npos || std::fabs(distSqr - bestDistSqr) > 1e-3f)
+				++nearestMismatches;
+
+			box_type range(lower, upper);
+			_bvh.overlap(range, found);
+			std::sort(found.begin(), found.end());
+			expected.clear();
+			for (size_t i = 0; i < COUNT; ++i)
+				if (boxes[i].overlaps(range))
+					expected.push_back(static_cast<uint32_t>(i));
+			if (found != expected)
+				++overlapMismatches;
+		}
+		cout << _name << ": raycast mismatches " << raycastMismatches << ", nearest mismatches " << nearestMismatches
+			<< ", overlap mismatches " << overlapMismatches << endl;
+	};
+
+	cckit::thread_pool pool;
+	bvh_type sah, linear, pooledLinear;
+	sah.build(boxes.data(), COUNT);
+	check(sah, "build");
+	linear.build_linear(boxes.data(), COUNT);
+	check(linear, "build_linear");
+	pooledLinear.build_linear(boxes.data(), COUNT, pool);
+	check(pooledLinear, "pooled build_linear");
+
+	// every object moves a bit, and the hierarchies only have their boxes updated
+	for (size_t i = 0; i < COUNT; ++i) {
+		float lower[3], upper[3];
+		for (size_t axis = 0; axis < 3; ++axis) {
+			lower[axis] = boxes[i].lower()[axis] + 5.0f * direction(rng);
+			upper[axis] = lower[axis] + extent(rng);
+		}
+		boxes[i] = box_type(lower, upper);
+	}
+	sah.refit(boxes.data());
+	check(sah, "build + refit");
+	linear.refit(boxes.data());
+	check(linear, "build_linear + refit");
+}
+
 void test_arithmetic()
 {
 	cout << cckit::mult(cckit::add(15, 23), 25) << endl;
@@ -650,9 +932,13 @@ int main()
 	//test_stack();
 	//test_queue();
 	//test_kd_tree();
+	//test_kd_tree_queries();
+	//test_bvh();
+	//test_quadtree_query_range();
 	//test_arithmetic();
 	//test_heap();
 	test_matrix();
+	//test_dynamic_matrix();
 
 	//demo_list();
 	//demo_stack();